@@ -12,8 +12,8 @@
  * more information about this standard, see the ISO8825-1 Basic Encoding
  * Rules: https://www.itu.int/ITU-T/studygroups/com17/languages/X.690-0207.pdf
  * 
- * Note: This library does not implement indefinite length TLV objects, as
- * described in section 8.1.3
+ * Indefinite length TLV objects, as described in section 8.1.3, are decoded
+ * with the length of their contents. Serializing always uses definite lengths.
  */
 
 /**
@@ -42,6 +42,15 @@
 
 #include "easytlv.h"
 #include <stdint.h>
+#ifndef ETLV_NO_MEMCPY
+    #include <string.h>
+#endif
+#ifdef ETLV_USE_MMAP
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
 
 
 // Debugging
@@ -54,9 +63,93 @@
 #define ETLV_LOG(...) ETLV_PRINTF("<etlv debug> " __VA_ARGS__)
 #define ETLV_LOG_LINE() ETLV_PRINTF("\n\r")
 
+// Statistics and tracing, kept per thread. Without ETLV_STATS, the counters
+// compile to nothing and errors pass straight through.
+#ifdef ETLV_STATS
+    #if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+        #define ETLV_THREAD_LOCAL _Thread_local
+    #elif defined(_MSC_VER)
+        #define ETLV_THREAD_LOCAL __declspec(thread)
+    #else
+        #define ETLV_THREAD_LOCAL __thread
+    #endif
+
+    static ETLV_THREAD_LOCAL ETLVStats stats;
+    static ETLV_THREAD_LOCAL ETLVTraceCb traceCb;
+    static ETLV_THREAD_LOCAL void* traceCtx;
+
+    #define ETLV_STAT(field, n) (stats.field += (n))
+    #define ETLV_STAT_MAX(field, n) \
+        (stats.field = stats.field > (n) ? stats.field : (n))
+    #define ETLV_STAT_ERR(err) stat_err(err)
+    #define ETLV_TRACE(tok, off) \
+        do { \
+            if (traceCb) \
+                trace_token((tok).tag, (tok).len, (tok).val, off); \
+        } while (0)
+
+    // Report a decoded object. The token is rebuilt here, so the decoders'
+    // own tokens never escape and can stay in registers.
+    static void trace_token(uint32_t tag, uint32_t len, const void* val,
+                            int off)
+    {
+        const ETLVToken TOK = {tag, len, val};
+        traceCb(traceCtx, ETLV_TRACE_TOKEN, &TOK, off);
+    }
+
+    // Count and trace an error returned by a decoder, and pass it on
+    static int stat_err(int err)
+    {
+        if (err < 0) {
+            const int I = err - ETLV_ERR_UNKNOWN;
+            if (I >= 0 && I < ETLV_ERR_COUNT)
+                stats.errors[I]++;
+            if (traceCb)
+                traceCb(traceCtx, ETLV_TRACE_ERROR, 0, err);
+        }
+        return err;
+    }
+#else
+    #define ETLV_STAT(field, n) ((void) (n))
+    #define ETLV_STAT_MAX(field, n) ((void) (n))
+    #define ETLV_STAT_ERR(err) (err)
+    #define ETLV_TRACE(tok, off)
+#endif
+
 #define GET_MSBYTE(i) ((i >> 24) & 0xFF)
 
 
+// Copy a block of value bytes. Targets without a C library can define
+// ETLV_NO_MEMCPY to fall back to a plain byte loop. An empty value may have a
+// NULL pointer, which must not reach memcpy. Selecting another pointer is
+// cheaper than branching around the call.
+static inline void copy_bytes(uint8_t* d, const uint8_t* s, uint32_t n)
+{
+#ifndef ETLV_NO_MEMCPY
+    memcpy(d, s ? s : d, n);
+#else
+    while (n--)
+        *d++ = *s++;
+#endif
+}
+
+// Move a block of bytes to a possibly overlapping destination
+static inline void move_bytes(uint8_t* d, const uint8_t* s, uint32_t n)
+{
+#ifndef ETLV_NO_MEMCPY
+    if (n)
+        memmove(d, s, n);
+#else
+    if (d < s) {
+        while (n--)
+            *d++ = *s++;
+    } else {
+        while (n--)
+            d[n] = s[n];
+    }
+#endif
+}
+
 // Compute the minimum number of bytes required to represent a number
 static inline uint8_t min_size(uint32_t d)
 {
@@ -76,6 +169,14 @@ static inline uint32_t trim_leading_zeros(uint32_t i)
     return i;
 }
 
+// Check the constructed bit in the first octet of a tag
+static inline int is_constructed(uint32_t tag)
+{
+    if (tag > 0xFF)
+        tag = GET_MSBYTE(trim_leading_zeros(tag));
+    return (tag & 0x20) != 0;
+}
+
 // Read the tag field from the source buffer and decode it
 // Modifies src to point to next byte after tag bytes
 // Returns tag, or negative error
@@ -97,17 +198,20 @@ static inline int decode_tag(uint32_t* tag, const uint8_t** src, int srcLen)
             return ETLV_ERR_INVAL;
 
         *tag = *s++;
+        uint8_t octet;
         do {
-            // Detect overflow
-            if ((*tag << 8) < *tag)
+            // The tag must end before the data does
+            if (s >= END)
+                return ETLV_ERR_MSGSIZE;
+
+            // Detect overflow, a fifth octet would shift out the first
+            if (*tag > 0x00FFFFFF)
                 return ETLV_ERR_OVERFLOW;
 
             // Join each octet of the tag
-            *tag = (*tag << 8) + (*s & 0xFF);
-        } while (s < END && *s++ & 0x80); // Last octet will clear MSB
-
-        if (s > END)
-            return ETLV_ERR_MSGSIZE;
+            octet = *s++;
+            *tag = (*tag << 8) + octet;
+        } while (octet & 0x80); // Last octet will clear MSB
 
         *src = s;
     } else { // Tag is just one byte
@@ -134,6 +238,11 @@ static inline int encode_tag(uint8_t** dest, int destLen, uint32_t tag)
     *dest = 0; // Reset dest to null
 
     if (tag < 0 || tag > 0xFF) { // Extended tag
+        // Determine how many tag bytes, the same way tag_size does. Trailing
+        // zero octets are part of the tag, so the count cannot come from the
+        // shifted value.
+        int n = min_size(tag);
+
         // Scan to first tag byte
         tag = trim_leading_zeros(tag);
         
@@ -142,7 +251,7 @@ static inline int encode_tag(uint8_t** dest, int destLen, uint32_t tag)
             return ETLV_ERR_INVAL;
 
         // Write tag bytes
-        while (tag > 0x00FFFFFF) {
+        while (n-- > 0) {
             // Check for enough memory
             if (d >= END)
                 return ETLV_ERR_NOMEM;
@@ -167,6 +276,21 @@ static inline int encode_tag(uint8_t** dest, int destLen, uint32_t tag)
     return d-BEGIN; 
 }
 
+// Compute the encoded size of a tag, using the same rules as encode_tag
+// Returns number of bytes required, or negative error
+static inline int tag_size(uint32_t tag)
+{
+    if (tag > 0xFF) { // Extended tag
+        if ((GET_MSBYTE(trim_leading_zeros(tag)) & 0x1F) < 31)
+            return ETLV_ERR_INVAL;
+        return min_size(tag);
+    }
+
+    if ((tag & 0x1F) > 30)
+        return ETLV_ERR_INVAL; // Invalid short tag
+    return 1;
+}
+
 // Read the length field from the source buffer and decode it
 // Modifies src to point to next byte after length bytes
 // Returns number of bytes read or negative error
@@ -188,7 +312,11 @@ static inline int decode_length(uint32_t* length, const uint8_t** src, int srcLe
             return ETLV_ERR_INVAL;
 
         const int N = *s++ & 0x7F; // Number of length bytes to use
-        if (N > 4 || (N > 3 && s[3] & 0x80))
+        if (N > 4)
+            return ETLV_ERR_OVERFLOW;
+        if (N > END-s)
+            return ETLV_ERR_MSGSIZE;
+        if (N > 3 && *s & 0x80) // Length must fit in a signed int
             return ETLV_ERR_OVERFLOW;
 
         int len = 0;
@@ -207,12 +335,237 @@ static inline int decode_length(uint32_t* length, const uint8_t** src, int srcLe
     return s-BEGIN;
 }
 
+// Read the tag and length fields from the source buffer and decode them
+// Modifies src to point to next byte after the length bytes
+// Returns number of bytes read or negative error
+static int decode_header_slow(uint32_t* tag, uint32_t* length,
+                              const uint8_t** src, const uint8_t* const END)
+{
+    const uint8_t* s = *src;
+
+    int err = decode_tag(tag, src, END-s);
+    if (err < 0)
+        return err;
+    const uint8_t* const LEN = *src;
+    err = decode_length(length, src, END - *src);
+    if (err < 0)
+        return err;
+    ETLV_STAT(extTags, *tag > 0xFF);
+    ETLV_STAT(longLens, *LEN >> 7);
+    return *src - s;
+}
+
+// Same as decode_header_slow, but small enough to be inlined into the loops
+// which decode many headers
+static inline int decode_header(uint32_t* tag, uint32_t* length,
+                                const uint8_t** src, const uint8_t* const END)
+{
+    const uint8_t* s = *src;
+
+#ifndef ETLV_NO_FAST_PATH
+    // Fast path for a single byte tag followed by a short form length. A tag
+    // is extended when its low 5 bits are all set, so adding 1 to them carries
+    // into bit 5. A length is in long form when its MSB is set, which is
+    // shifted down onto bit 5. Both cases are tested with one branch.
+    if (END-s >= 2 && !((((s[0] & 0x1F) + 1) | (s[1] >> 2)) & 0x20)) {
+        *tag = s[0];
+        *length = s[1];
+        *src = s+2;
+        return 2;
+    }
+#endif
+
+    // Decode through locals, so the caller's variables can stay in registers
+    uint32_t t, l;
+    int err = decode_header_slow(&t, &l, &s, END);
+    if (err < 0)
+        return err;
+    *tag = t;
+    *length = l;
+    *src = s;
+    return err;
+}
+
+// Skip a run of objects with single byte tags and short form lengths,
+// stopping at any other object or at an object with the tag `stop`
+// Modifies src to point to the first object not skipped, which may be past END
+// Returns number of objects skipped
+static inline int skip_short(const uint8_t** src, const uint8_t* const END,
+                             uint32_t stop)
+{
+    const uint8_t* s = *src;
+
+    // Walking headers is a serial chain of dependent loads, each header
+    // position depends on the length before it. So this is kept to one load
+    // and one add per object, with no token to fill in.
+    int n = 0;
+#ifndef ETLV_NO_FAST_PATH
+    while (END-s >= 2 && !((((s[0] & 0x1F) + 1) | (s[1] >> 2)) & 0x20) &&
+           s[0] != stop) {
+        s += 2 + s[1];
+        n++;
+    }
+#else
+    (void) END;
+    (void) stop;
+#endif
+
+    *src = s;
+    return n;
+}
+
+// An indefinite length is a long form length without any length octets. It
+// decodes as a length of 0, with the 0x80 octet right before the value.
+static inline int is_indefinite(uint32_t length, const uint8_t* val)
+{
+    return length == 0 && val[-1] == 0x80;
+}
+
+// Find the end-of-contents octets (00 00) closing an indefinite length value
+// starting at src. Nested objects are skipped, and nested indefinite length
+// objects are only counted, so the value is walked once.
+// Returns size of the end-of-contents, or negative error
+static int indefinite_length(uint32_t* length, const uint8_t* src,
+                             const uint8_t* const END)
+{
+    const uint8_t* s = src;
+
+    int open = 1;
+    int err = 0;
+    uint32_t tag;
+    uint32_t len;
+    while (1) {
+        if (END-s < 2) // End-of-contents is missing
+            return ETLV_ERR_MSGSIZE;
+        if (s[0] == 0 && s[1] == 0) {
+            if (--open == 0)
+                break;
+            s += 2;
+            continue;
+        }
+
+        err = decode_header(&tag, &len, &s, END);
+        if (err < 0)
+            return err;
+        if (is_indefinite(len, s)) {
+            if (!is_constructed(tag))
+                return ETLV_ERR_INVAL;
+            open++;
+            continue;
+        }
+        if (len > (uint32_t)(END-s))
+            return ETLV_ERR_MSGSIZE;
+        s += len;
+    }
+
+    // Output the length of the value, without the end-of-contents
+    *length = s-src;
+    return 2;
+}
+
+// Resolve the length of an object whose header was just decoded, with src
+// pointing to its value. An indefinite length is replaced by the length of
+// the value.
+// Returns size of the end-of-contents after the value, or negative error
+static inline int resolve_length(uint32_t tag, uint32_t* length,
+                                 const uint8_t* src, const uint8_t* const END)
+{
+    if (!is_indefinite(*length, src))
+        return 0;
+    if (!is_constructed(tag)) // Primitive values need a definite length
+        return ETLV_ERR_INVAL;
+
+    // Find the length through a local, so the caller's can stay in a register
+    uint32_t l;
+    int err = indefinite_length(&l, src, END);
+    if (err < 0)
+        return err;
+    *length = l;
+    return err;
+}
+
+// Same as decode_length, for lengths of up to 8 octets
+static inline int decode_length_ex(uint64_t* length, const uint8_t** src,
+                                   size_t srcLen)
+{
+    if (!length || !src || !*src)
+        return ETLV_ERR_BADARG;
+    if (srcLen == 0)
+        return ETLV_ERR_NODATA;
+
+    const uint8_t* s = *src;
+    const uint8_t* const BEGIN = s;
+    *src = 0; // Reset src to null
+
+    if (*s & 0x80) { // Is the length in long form?
+        // The first byte must not be 0xFF
+        if (*s == 0xFF)
+            return ETLV_ERR_INVAL;
+
+        const size_t N = *s++ & 0x7F; // Number of length bytes to use
+        if (N > 8)
+            return ETLV_ERR_OVERFLOW;
+        if (N > srcLen - 1)
+            return ETLV_ERR_MSGSIZE;
+        if (N > 7 && *s & 0x80) // Length must fit in an int64_t
+            return ETLV_ERR_OVERFLOW;
+        if (N == 0) // Indefinite lengths are not supported here
+            return ETLV_ERR_INVAL;
+
+        uint64_t len = 0;
+        for (size_t i = 0; i < N; i++)
+            len = (len << 8) + s[i];
+        *src = s+N;
+        *length = len;
+    } else { // Length is just one byte
+        *src = s+1;
+        *length = *s;
+    }
+
+    return *src - BEGIN;
+}
+
+// Same as decode_header, for the _ex API family
+static inline int decode_header_ex(uint32_t* tag, uint64_t* length,
+                                   const uint8_t** src, const uint8_t* const END)
+{
+    const uint8_t* s = *src;
+
+#ifndef ETLV_NO_FAST_PATH
+    if (END-s >= 2 && !((((s[0] & 0x1F) + 1) | (s[1] >> 2)) & 0x20)) {
+        *tag = s[0];
+        *length = s[1];
+        *src = s+2;
+        return 2;
+    }
+#endif
+
+    // A tag never needs more than a few bytes, so clamp the size passed on
+    const size_t REMAIN = END-s;
+    uint32_t t;
+    uint64_t l;
+    int err = decode_tag(&t, &s, REMAIN < 16 ? (int) REMAIN : 16);
+    if (err < 0)
+        return err;
+    const uint8_t* const LEN = s;
+    err = decode_length_ex(&l, &s, END-s);
+    if (err < 0)
+        return err;
+    ETLV_STAT(extTags, t > 0xFF);
+    ETLV_STAT(longLens, *LEN >> 7);
+    *tag = t;
+    *length = l;
+    err = s - *src;
+    *src = s;
+    return err;
+}
+
 // Encode the length and Write it to the destination buffer
 // Modifies dest to point to next byte after length bytes
 // Returns number of bytes written, or negative error
 static inline int encode_length(uint8_t** dest, int destLen, uint32_t length)
 {
-    if (!dest || !*dest || length <= 0)
+    if (!dest || !*dest)
         return ETLV_ERR_BADARG;
     if (destLen <= 0)
         return ETLV_ERR_NOMEM;
@@ -250,11 +603,50 @@ static inline int encode_length(uint8_t** dest, int destLen, uint32_t length)
     return d-BEGIN;
 }
 
-int etlv_parse(ETLVToken* t, int* nTok, const void* src, int srcLen)
+// Same as encode_length, for lengths of up to 8 octets
+static inline int encode_length_ex(uint8_t** dest, size_t destLen,
+                                   uint64_t length)
 {
-    if (!t || !nTok || *nTok < 0 || !src || srcLen < 0)
+    if (!dest || !*dest)
         return ETLV_ERR_BADARG;
+    if (length > INT64_MAX)
+        return ETLV_ERR_OVERFLOW;
+
+    // Determine how many length bytes
+    int n = 0;
+    if (length > 0x7F)
+        for (uint64_t l = length; l; l >>= 8)
+            n++;
+    if (destLen < (size_t) n + 1)
+        return ETLV_ERR_NOMEM;
+
+    uint8_t* d = *dest;
+    if (n) { // Long form
+        *d++ = (n | 0x80) & 0xFF;
+        while (n-- > 0)
+            *d++ = (length >> (8*n)) & 0xFF;
+    } else { // Short form
+        *d++ = length & 0xFF;
+    }
+
+    n = d - *dest;
+    *dest = d;
+    return n;
+}
+
+// Compute the encoded size of a length, using the same rules as encode_length
+// Returns number of bytes required
+static inline int length_size(uint32_t length)
+{
+    if (length > 0x7F) // Long form
+        return 1 + min_size(length);
+    return 1;
+}
 
+// Parse one level of TLV objects, see etlv_parse
+// Arguments must already be checked by the caller
+static int parse_level(ETLVToken* t, int* nTok, const void* src, int srcLen)
+{
     const uint8_t* s = src;
     const uint8_t* const BEGIN = s;
     const uint8_t* const END = s + srcLen;
@@ -263,148 +655,2485 @@ int etlv_parse(ETLVToken* t, int* nTok, const void* src, int srcLen)
     ETLV_LOG_HEX(src, srcLen);
     ETLV_LOG_LINE();
 
+    // Without a token array, only count the tokens
+    const int MAX_TOK = t ? *nTok : 0;
+
+    ETLVToken tok;
     int n = 0;
     int err = 0;
     while (s < END) {
-        // Check for memory
-        if (n >= *nTok) {
-            n = ETLV_ERR_NOMEM;
-            break;
+        // Once tokens are no longer stored, skip short objects quickly
+        if (n >= MAX_TOK) {
+            n += skip_short(&s, END, 0x100);
+            if (s >= END)
+                break;
         }
 
-        // Decode the tag field
-        err = decode_tag(&t[n].tag, &s, END-s);
+        // Decode the tag and length fields
+        err = decode_header(&tok.tag, &tok.len, &s, END);
         if (err < 0) {
             n = err;
             break;
         }
-        ETLV_LOG("tag: %08X\n\r", t[n].tag);
-
-        // Decode the length field
-        err = decode_length(&t[n].len, &s, END-s);
+        err = resolve_length(tok.tag, &tok.len, s, END);
         if (err < 0) {
             n = err;
             break;
         }
-        ETLV_LOG("len: %u\n\r", t[n].len);
+        ETLV_LOG("tag: %08X\n\r", tok.tag);
+        ETLV_LOG("len: %u\n\r", tok.len);
 
         // Save pointer to value field
-        t[n].val = s;
-        if (t[n].val == 0) {
+        tok.val = s;
+        if (tok.val == 0) {
             n = ETLV_ERR_UNKNOWN;
             break;
         }
         ETLV_LOG("val: ");
-        ETLV_LOG_HEX(t[n].val, t[n].len);
+        ETLV_LOG_HEX(tok.val, tok.len);
         ETLV_LOG_LINE();
+        ETLV_TRACE(tok, s-BEGIN);
 
-        // Point to next object
-        s = t[n].val + t[n].len; 
+        // Store the token, if there is room for it
+        if (n < MAX_TOK)
+            t[n] = tok;
+
+        // Point to next object, past any end-of-contents
+        s += tok.len + err;
         n++;
     }
 
     // Output the number of tokens found
     if (n >= 0)
         *nTok = n;
+    ETLV_STAT(tokens, n >= 0 ? n : 0);
+    ETLV_STAT(bytes, srcLen);
 
     // Handle errors
     if (n < 0) // Error during parse loop
-        return n;
+        return ETLV_STAT_ERR(n);
     if (s > END) // TLV data exceeds byte array provided
-        return ETLV_ERR_MSGSIZE;
+        return ETLV_STAT_ERR(ETLV_ERR_MSGSIZE);
+    if (t && n > MAX_TOK) // Token array was too small
+        return ETLV_STAT_ERR(ETLV_ERR_NOMEM);
 
     // Return the total length of the TLV data
     return s-BEGIN;
 }
 
-int etlv_serialize(void* dest, int* len, const ETLVToken* t, int nTok)
+ETLV_API int etlv_parse(ETLVToken* t, int* nTok, const void* src, int srcLen)
 {
-    if (!dest || !len || *len < 0 || !t || nTok < 0)
+    if (!nTok || (t && *nTok < 0) || !src || srcLen < 0)
         return ETLV_ERR_BADARG;
 
-    uint8_t* d = dest;
-    const uint8_t* const BEGIN = d;
-    const uint8_t* const END = d + *len;
-
-    ETLV_LOG("Serializing %d tokens into %i byte buffer\n\r", nTok, *len);
+    return parse_level(t, nTok, src, srcLen);
+}
 
-    *len = 0;
-    int err = 0;
-    for (int i = 0; i < nTok; i++) {
-        // Write the tag field
-        ETLV_LOG("tag: %08X\n\r", t[i].tag);
-        err = encode_tag(&d, END-d, t[i].tag);
-        if (err < 0)
-            return err;
-        if (*len + err < *len)
-            return ETLV_ERR_OVERFLOW;
+// Shared state of the jobs of one etlv_parse_batch
+typedef struct {
+    ETLVRecord* r;
+    int         nRec;
+    int         perJob;     // Records handled by each job
+    ETLVToken*  t;          // Token arena, or NULL to only count
+} BatchJob;
 
-        // Write the length field
-        ETLV_LOG("len: %u\n\r", t[i].len);
-        err = encode_length(&d, END-d, t[i].len);
-        if (err < 0)
-            return err;
-        if (*len + err < *len)
-            return ETLV_ERR_OVERFLOW;
+// Parse (or count) the tokens of one job's share of a batch
+static void batch_job(void* arg, int i)
+{
+    BatchJob* b = arg;
+    const int first = i * b->perJob;
+    const int last = first + b->perJob < b->nRec ? first + b->perJob : b->nRec;
+
+    for (int k = first; k < last; k++) {
+        ETLVRecord* r = &b->r[k];
+        if (!b->t) {
+            r->nTok = 0;
+            r->result = parse_level(NULL, &r->nTok, r->src, r->srcLen);
+        } else if (r->result >= 0) {
+            r->result = parse_level(b->t + r->first, &r->nTok, r->src, r->srcLen);
+        }
+    }
+}
 
-        // Copy the value
-        ETLV_LOG("val: ");
-        ETLV_LOG_HEX(t[i].val, t[i].len);
-        ETLV_LOG_LINE();
-        const uint8_t* v = t[i].val;
-        const uint8_t* const VAL_END = v + t[i].len;
-        while (v < VAL_END) {
-            // Make sure not to overrun the buffer
-            if (d >= END)
-                return ETLV_ERR_NOMEM;
+ETLV_API int etlv_parse_batch(ETLVRecord* r, int nRec, ETLVToken* t, int nTok,
+                              const ETLVPool* pool)
+{
+    if (!r || nRec < 0 || !t || nTok < 0)
+        return ETLV_ERR_BADARG;
+    if (pool && (!pool->run || pool->nJobs <= 0))
+        return ETLV_ERR_BADARG;
+    for (int k = 0; k < nRec; k++)
+        if (!r[k].src || r[k].srcLen < 0)
+            return ETLV_ERR_BADARG;
+
+    int used = 0;
+    if (!pool) {
+        // Parse each record straight into the remaining arena
+        for (int k = 0; k < nRec; k++) {
+            r[k].first = used;
+            r[k].nTok = nTok - used;
+            r[k].result = parse_level(t + used, &r[k].nTok, r[k].src, r[k].srcLen);
+            if (r[k].result >= 0)
+                used += r[k].nTok;
+            else if (r[k].result != ETLV_ERR_NOMEM)
+                r[k].nTok = 0;
+        }
+        return used;
+    }
 
-            *d++ = *v++;
+    // Count the tokens of every record, to find each record's arena slice
+    BatchJob b = {
+        .r = r,
+        .nRec = nRec,
+        .perJob = (nRec + pool->nJobs - 1) / pool->nJobs,
+        .t = 0,
+    };
+    const int N_JOBS = b.perJob ? (nRec + b.perJob - 1) / b.perJob : 0;
+    pool->run(pool->ctx, batch_job, &b, N_JOBS);
+
+    for (int k = 0; k < nRec; k++) {
+        r[k].first = used;
+        if (r[k].result < 0) {
+            r[k].nTok = 0;
+            continue;
         }
+        if (r[k].nTok > nTok - used) {
+            r[k].result = ETLV_ERR_NOMEM;
+            continue;
+        }
+        used += r[k].nTok;
     }
 
-    // Return total serialized length
-    return *len = d-BEGIN;
+    // Parse every record into its own slice
+    b.t = t;
+    pool->run(pool->ctx, batch_job, &b, N_JOBS);
+
+    return used;
 }
 
-int etlv_find(ETLVToken* t, uint32_t tag, const void* src, int srcLen)
+ETLV_API int etlv_parse_tree(ETLVNode* nodes, int* nNodes, const void* src,
+                             int srcLen)
 {
-    if (!t || !src || srcLen < 0)
+    if (!nodes || !nNodes || *nNodes < 0 || !src || srcLen < 0)
         return ETLV_ERR_BADARG;
 
     const uint8_t* s = src;
     const uint8_t* const BEGIN = s;
     const uint8_t* const END = s + srcLen;
 
-    int err;
-    uint32_t found;
-    uint32_t len;
-    int offset = 0;
-    while (s < END) {
-        offset = s-BEGIN;
-        err = decode_tag(&found, &s, END-s);
-        if (err < 0)
+    int n = 0;
+    int err = 0;
+    int depth = 0;
+    int parent = -1;        // Constructed object currently being parsed
+    int prev = -1;          // Previous sibling on the current level
+    const uint8_t* pend = END; // End of the current parent's value
+    while (1) {
+        // Close every constructed object whose value has been consumed. An
+        // object of indefinite length is closed by its end-of-contents, and
+        // until then its length is the room left in its parent.
+        while (parent >= 0) {
+            ETLVNode* p = &nodes[parent];
+            if (p->flags & ETLV_NODE_INDEFINITE) {
+                if (pend-s < 2 || s[0] || s[1]) {
+                    if (s >= pend) // End-of-contents is missing
+                        n = ETLV_ERR_MSGSIZE;
+                    break;
+                }
+                p->tok.len = s - (const uint8_t*) p->tok.val;
+                s += 2;
+            } else if (s < pend) {
+                break;
+            }
+
+            prev = parent;
+            parent = p->parent;
+            pend = parent < 0 ? END :
+                (const uint8_t*) nodes[parent].tok.val + nodes[parent].tok.len;
+            depth--;
+        }
+        if (n < 0 || s >= END)
             break;
-        ETLV_LOG("Found tag: 0x%08X\n\r", found);
-        err = decode_length(&len, &s, END-s);
-        if (err < 0)
+
+        // Check for memory
+        if (n >= *nNodes) {
+            n = ETLV_ERR_NOMEM;
+            break;
+        }
+
+        // The header and value must fit inside of the parent's value
+        ETLVNode* node = &nodes[n];
+        err = decode_header(&node->tok.tag, &node->tok.len, &s, pend);
+        if (err < 0) {
+            n = err;
             break;
-        if (found == tag)
+        }
+        ETLV_LOG("depth %d tag: %08X len: %u\n\r", depth, node->tok.tag,
+                 node->tok.len);
+        node->tok.val = s;
+        ETLV_TRACE(node->tok, s-BEGIN);
+
+        node->flags = 0;
+        if (is_indefinite(node->tok.len, s)) {
+            if (!is_constructed(node->tok.tag)) {
+                n = ETLV_ERR_INVAL;
+                break;
+            }
+            node->flags = ETLV_NODE_INDEFINITE;
+            node->tok.len = pend-s;
+        } else if (node->tok.len > (uint32_t)(pend-s)) {
+            n = ETLV_ERR_MSGSIZE;
             break;
-        s += len;
+        }
+        node->depth = depth;
+        node->parent = parent;
+        node->next = -1;
+        if (prev >= 0)
+            nodes[prev].next = n;
+
+        if (node->flags & ETLV_NODE_INDEFINITE ||
+            (is_constructed(node->tok.tag) && node->tok.len > 0)) {
+            // Descend into the value
+            parent = n;
+            prev = -1;
+            pend = s + node->tok.len;
+            depth++;
+        } else {
+            // Skip to the next sibling
+            prev = n;
+            s += node->tok.len;
+        }
+        n++;
     }
 
-    if (err < 0)
-        return err;
-
-    if (s >= END)
-        return ETLV_ERR_NOENT;
+    ETLV_STAT(tokens, n >= 0 ? n : 0);
+    ETLV_STAT(bytes, srcLen);
+    if (n < 0)
+        return ETLV_STAT_ERR(n);
 
-    // Output a token for the found tag
-    t->tag = found;
-    t->len = len;
-    t->val = s;
+    // Output the number of nodes found
+    *nNodes = n;
 
-    // Return the byte offset of the found token
-    return offset;
+    // Return the total length of the TLV data
+    return s-BEGIN;
 }
 
+// Most jobs a parallel operation is split into
+#define PARALLEL_MAX_JOBS 64
+
+// Count the nodes etlv_parse_tree would produce for the data. Nested values
+// directly follow their headers, so walking the headers in pre-order needs no
+// knowledge of where each parent ends. The bounds of nested values are checked
+// later, by the parse itself. While an object of indefinite length is open,
+// 00 00 is taken as its end-of-contents, which is the only place valid BER
+// can hold it.
+// Returns number of nodes, or negative error
+static int count_nodes(const uint8_t* s, const uint8_t* const END)
+{
+    int n = 0;
+    int err = 0;
+    int open = 0; // Open objects of indefinite length
+    uint32_t tag;
+    uint32_t len;
+    while (s < END) {
+        if (open && END-s >= 2 && s[0] == 0 && s[1] == 0) {
+            s += 2;
+            open--;
+            continue;
+        }
+
+        err = decode_header(&tag, &len, &s, END);
+        if (err < 0)
+            return err;
+        if (n + 1 < n)
+            return ETLV_ERR_OVERFLOW;
+        n++;
+
+        // Descend into constructed values, skip everything else
+        if (is_indefinite(len, s)) {
+            if (!is_constructed(tag))
+                return ETLV_ERR_INVAL;
+            open++;
+        } else if (!is_constructed(tag) || len == 0) {
+            if (len > (uint32_t)(END-s))
+                return ETLV_ERR_MSGSIZE;
+            s += len;
+        }
+    }
+    return n;
+}
+
+// Shared state of the jobs of one etlv_parse_tree_parallel
+typedef struct {
+    ETLVNode*       nodes;
+    const uint8_t*  start[PARALLEL_MAX_JOBS + 1];   // Range of each job
+    int             first[PARALLEL_MAX_JOBS];       // First node of each job
+    int             count[PARALLEL_MAX_JOBS];       // Nodes, or negative error
+    int             last[PARALLEL_MAX_JOBS];        // Last top level node
+    int             parse;                          // Count or parse pass
+} TreeJob;
+
+// Count or parse the nodes of one job's range
+static void tree_job(void* arg, int i)
+{
+    TreeJob* b = arg;
+    const uint8_t* const S = b->start[i];
+    const int LEN = b->start[i+1] - S;
+
+    if (!b->parse) {
+        b->count[i] = count_nodes(S, S + LEN);
+        return;
+    }
+
+    ETLVNode* const nodes = b->nodes + b->first[i];
+    int n = b->count[i];
+    int err = etlv_parse_tree(nodes, &n, S, LEN);
+    if (err == ETLV_ERR_NOMEM || (err >= 0 && n != b->count[i]))
+        err = ETLV_ERR_INVAL; // Misplaced end-of-contents, see count_nodes
+    if (err < 0) {
+        b->count[i] = err;
+        return;
+    }
+
+    // Make the indices relative to the whole node array
+    const int BASE = b->first[i];
+    for (int k = 0; k < n; k++) {
+        if (nodes[k].parent >= 0)
+            nodes[k].parent += BASE;
+        if (nodes[k].next >= 0)
+            nodes[k].next += BASE;
+    }
+
+    // Find the last top level node, to link it to the next range
+    int last = n ? 0 : -1;
+    while (last >= 0 && nodes[last].next >= 0)
+        last = nodes[last].next - BASE;
+    b->last[i] = last < 0 ? -1 : last + BASE;
+}
+
+ETLV_API int etlv_parse_tree_parallel(ETLVNode* nodes, int* nNodes,
+                                      const void* src, int srcLen,
+                                      const ETLVPool* pool)
+{
+    if (!nodes || !nNodes || *nNodes < 0 || !src || srcLen < 0 || !pool ||
+        !pool->run || pool->nJobs <= 0)
+        return ETLV_ERR_BADARG;
+
+    const uint8_t* s = src;
+    const uint8_t* const BEGIN = s;
+    const uint8_t* const END = s + srcLen;
+
+    TreeJob b;
+    b.nodes = nodes;
+    b.parse = 0;
+
+    // Split the top level objects into ranges of about the same size
+    const int N_JOBS = pool->nJobs < PARALLEL_MAX_JOBS ?
+                       pool->nJobs : PARALLEL_MAX_JOBS;
+    int k = 0;
+    int err = 0;
+    uint32_t tag;
+    uint32_t len;
+    while (s < END) {
+        if (s-BEGIN >= (int64_t) srcLen * k / N_JOBS)
+            b.start[k++] = s;
+
+        err = decode_header(&tag, &len, &s, END);
+        if (err < 0)
+            goto in_order;
+        err = resolve_length(tag, &len, s, END);
+        if (err < 0 || len > (uint32_t)(END-s))
+            goto in_order;
+        s += len + err;
+    }
+    const int N_RANGES = k;
+    b.start[N_RANGES] = END;
+
+    // Count the nodes of each range, to find each range's slice of nodes
+    pool->run(pool->ctx, tree_job, &b, N_RANGES);
+    int total = 0;
+    for (k = 0; k < N_RANGES; k++) {
+        if (b.count[k] < 0 || b.count[k] > *nNodes - total)
+            goto in_order;
+        b.first[k] = total;
+        total += b.count[k];
+    }
+
+    // Parse each range into its own slice
+    b.parse = 1;
+    pool->run(pool->ctx, tree_job, &b, N_RANGES);
+    for (k = 0; k < N_RANGES; k++)
+        if (b.count[k] < 0)
+            goto in_order;
+
+    // Stitch the top level objects of the ranges together
+    for (k = 0; k + 1 < N_RANGES; k++)
+        nodes[b.last[k]].next = b.first[k+1];
+
+    // Output the number of nodes found
+    *nNodes = total;
+
+    // Return the total length of the TLV data
+    return srcLen;
+
+in_order:
+    // The ranges are checked out of order, and the top level headers before
+    // anything nested, so the first error found need not be the first in the
+    // data. Parsing again in order reports the error etlv_parse_tree does.
+    return etlv_parse_tree(nodes, nNodes, src, srcLen);
+}
+
+ETLV_API int etlv_serialize(void* dest, int* len, const ETLVToken* t, int nTok)
+{
+    if (!dest || !len || *len < 0 || !t || nTok < 0)
+        return ETLV_ERR_BADARG;
+
+    uint8_t* d = dest;
+    const uint8_t* const BEGIN = d;
+    const uint8_t* const END = d + *len;
+
+    ETLV_LOG("Serializing %d tokens into %i byte buffer\n\r", nTok, *len);
+
+    *len = 0;
+    int err = 0;
+    for (int i = 0; i < nTok; i++) {
+        // Write the tag field
+        ETLV_LOG("tag: %08X\n\r", t[i].tag);
+        err = encode_tag(&d, END-d, t[i].tag);
+        if (err < 0)
+            return err;
+        if (*len + err < *len)
+            return ETLV_ERR_OVERFLOW;
+
+        // Write the length field
+        ETLV_LOG("len: %u\n\r", t[i].len);
+        err = encode_length(&d, END-d, t[i].len);
+        if (err < 0)
+            return err;
+        if (*len + err < *len)
+            return ETLV_ERR_OVERFLOW;
+
+        // Copy the value
+        ETLV_LOG("val: ");
+        ETLV_LOG_HEX(t[i].val, t[i].len);
+        ETLV_LOG_LINE();
+        // Make sure not to overrun the buffer
+        if (t[i].len > (uint32_t)(END-d))
+            return ETLV_ERR_NOMEM;
+        copy_bytes(d, t[i].val, t[i].len);
+        d += t[i].len;
+    }
+
+    // Return total serialized length
+    return *len = d-BEGIN;
+}
+
+// Check if a node of a pre-order node array has children
+static inline int has_children(const ETLVNode* nodes, int nNodes, int i)
+{
+    return i + 1 < nNodes && nodes[i+1].parent == i;
+}
+
+// Shared state of the jobs of one etlv_serialize_tree
+typedef struct {
+    const ETLVNode* nodes;
+    int             nNodes;
+    uint8_t*        dest;
+    int             first[PARALLEL_MAX_JOBS + 1];   // First node of each job
+    int             offset[PARALLEL_MAX_JOBS];      // First byte of each job
+} SerializeJob;
+
+// Serialize the nodes of one job's range. Sizes were already checked.
+static void serialize_job(void* arg, int i)
+{
+    SerializeJob* b = arg;
+    uint8_t* d = b->dest + b->offset[i];
+    for (int k = b->first[i]; k < b->first[i+1]; k++) {
+        const ETLVToken* t = &b->nodes[k].tok;
+        encode_tag(&d, 16, t->tag);
+        encode_length(&d, 16, t->len);
+
+        // Constructed values are written by the children that follow
+        if (!has_children(b->nodes, b->nNodes, k)) {
+            copy_bytes(d, t->val, t->len);
+            d += t->len;
+        }
+    }
+}
+
+ETLV_API int etlv_serialize_tree(void* dest, int* len, ETLVNode* nodes,
+                                 int nNodes, const ETLVPool* pool)
+{
+    if (!dest || !len || *len < 0 || !nodes || nNodes < 0)
+        return ETLV_ERR_BADARG;
+    if (pool && (!pool->run || pool->nJobs <= 0))
+        return ETLV_ERR_BADARG;
+
+    // The lengths of constructed values are summed up from their children
+    for (int i = 0; i < nNodes; i++) {
+        // In pre-order, the parent is the node before, or one of its open
+        // ancestors. The parent links of the node before are the stack of
+        // open objects, and the objects popped here are never open again,
+        // so each node is walked over at most once.
+        if (nodes[i].parent < -1 || nodes[i].parent >= i)
+            return ETLV_ERR_INVAL; // Not in pre-order
+        int open = i - 1;
+        while (open > nodes[i].parent)
+            open = nodes[open].parent;
+        if (open != nodes[i].parent)
+            return ETLV_ERR_INVAL; // Not in pre-order
+        if (has_children(nodes, nNodes, i))
+            nodes[i].tok.len = 0;
+    }
+
+    uint64_t total = 0;
+    int err = 0;
+    for (int i = nNodes - 1; i >= 0; i--) {
+        err = tag_size(nodes[i].tok.tag);
+        if (err < 0)
+            return err;
+        uint64_t size = err + (uint64_t) nodes[i].tok.len;
+        err = length_size(nodes[i].tok.len);
+        if (err < 0)
+            return err;
+        size += err;
+
+        // Add the object to its parent, or the total
+        uint64_t sum = size + (nodes[i].parent < 0 ? total :
+                               nodes[nodes[i].parent].tok.len);
+        if (sum > INT32_MAX)
+            return ETLV_ERR_OVERFLOW;
+        if (nodes[i].parent < 0)
+            total = sum;
+        else
+            nodes[nodes[i].parent].tok.len = sum;
+    }
+    if (total > (uint64_t) *len)
+        return ETLV_ERR_NOMEM;
+
+    // Every node starts right after the bytes of the node before it, its
+    // header and, if it has no children, its value. So the nodes are split
+    // into ranges of about the same size, with known starting offsets.
+    SerializeJob b = {.nodes = nodes, .nNodes = nNodes, .dest = dest};
+    const int N_JOBS = !pool ? 1 : pool->nJobs < PARALLEL_MAX_JOBS ?
+                       pool->nJobs : PARALLEL_MAX_JOBS;
+    int k = 0;
+    uint64_t offset = 0;
+    for (int i = 0; i < nNodes; i++) {
+        if (offset >= total * k / N_JOBS) {
+            b.first[k] = i;
+            b.offset[k] = offset;
+            k++;
+        }
+        const ETLVToken* t = &nodes[i].tok;
+        offset += tag_size(t->tag) + length_size(t->len);
+        if (!has_children(nodes, nNodes, i))
+            offset += t->len;
+    }
+    const int N_RANGES = k;
+    b.first[N_RANGES] = nNodes;
+
+    // Write every range straight into its final place
+    if (pool)
+        pool->run(pool->ctx, serialize_job, &b, N_RANGES);
+    else if (N_RANGES)
+        serialize_job(&b, 0);
+
+    // Return total serialized length
+    return *len = total;
+}
+
+// Find the first header byte of a node parsed from buf by etlv_parse_tree.
+// Every object starts where its previous sibling ends, or else where its
+// parent's value starts.
+static const uint8_t* node_header(const uint8_t* buf, const ETLVNode* nodes,
+                                  int k)
+{
+    // Node k-1 is either the parent, or inside of the previous sibling
+    const int PARENT = nodes[k].parent;
+    int j = k - 1;
+    while (j >= 0 && j != PARENT && nodes[j].parent != PARENT)
+        j = nodes[j].parent;
+
+    if (j < 0)
+        return buf;
+    if (j == PARENT)
+        return nodes[j].tok.val;
+    return (const uint8_t*) nodes[j].tok.val + nodes[j].tok.len +
+           (nodes[j].flags & ETLV_NODE_INDEFINITE ? 2 : 0);
+}
+
+// Encode a length into exactly `width` bytes, which must be enough to hold it
+static inline void encode_length_width(uint8_t* d, int width, uint32_t length)
+{
+    if (width == 1) { // Short form
+        *d = length & 0xFF;
+        return;
+    }
+
+    *d++ = (0x80 | (width - 1)) & 0xFF;
+    while (--width > 0)
+        *d++ = (length >> (8 * (width - 1))) & 0xFF;
+}
+
+ETLV_API int etlv_patch(void* buf, int* len, int cap, ETLVNode* nodes,
+                        int nNodes, int idx, const void* val, int valLen)
+{
+    if (!buf || !len || *len < 0 || cap < *len || !nodes || idx < 0 ||
+        idx >= nNodes || (!val && valLen) || valLen < 0)
+        return ETLV_ERR_BADARG;
+
+    // Only a value without nodes inside of it can be replaced
+    ETLVNode* const node = &nodes[idx];
+    if (has_children(nodes, nNodes, idx) || node->flags & ETLV_NODE_INDEFINITE)
+        return ETLV_ERR_INVAL;
+    // An empty value of tag 0 would read as the end-of-contents of its parent
+    if (!node->tok.tag && !valLen && node->parent >= 0 &&
+        nodes[node->parent].flags & ETLV_NODE_INDEFINITE)
+        return ETLV_ERR_INVAL;
+
+    uint8_t* const BUF = buf;
+    const uint8_t* const END = BUF + *len;
+    uint8_t* const V = (uint8_t*) node->tok.val;
+    if (V < BUF || node->tok.len > (uint32_t)(END-V))
+        return ETLV_ERR_INVAL; // Node does not belong to this buffer
+
+    // Fast path, nothing but the value changes
+    if ((uint32_t) valLen == node->tok.len) {
+        copy_bytes(V, val, valLen);
+        return *len;
+    }
+
+    // Collect the node and its ancestors, innermost first, with their length
+    // fields and new lengths. Every length changes in the same direction as
+    // the value. A length field only changes width in that direction too, so
+    // a non-minimal field is kept when the length grows. That way the bytes
+    // between two length fields are shifted further, the closer they are to
+    // the value, and can be moved in order without overwriting each other.
+    int chain[ETLV_PATCH_MAX_DEPTH + 1];
+    uint8_t* field[ETLV_PATCH_MAX_DEPTH + 1];   // Old length field
+    uint32_t newLen[ETLV_PATCH_MAX_DEPTH + 1];
+    uint8_t oldWidth[ETLV_PATCH_MAX_DEPTH + 1];
+    uint8_t newWidth[ETLV_PATCH_MAX_DEPTH + 1];
+    int n = 0;
+    int64_t delta = (int64_t) valLen - node->tok.len; // Growth so far
+    for (int k = idx; k >= 0; k = nodes[k].parent) {
+        if (n > ETLV_PATCH_MAX_DEPTH)
+            return ETLV_ERR_OVERFLOW;
+
+        const ETLVToken* t = &nodes[k].tok;
+        uint8_t* v = (uint8_t*) t->val;
+        if (v < BUF || v > END)
+            return ETLV_ERR_INVAL;
+        if (t->len + delta > INT32_MAX)
+            return ETLV_ERR_OVERFLOW;
+
+        chain[n] = k;
+        newLen[n] = t->len + delta;
+        if (nodes[k].flags & ETLV_NODE_INDEFINITE) {
+            // No length field, the end-of-contents just moves along
+            field[n] = v;
+            oldWidth[n] = newWidth[n] = 0;
+        } else {
+            uint8_t* h = (uint8_t*) node_header(BUF, nodes, k);
+            const uint8_t* s = h;
+            uint32_t tag;
+            int err = decode_tag(&tag, &s, v-h);
+            if (err < 0)
+                return ETLV_ERR_INVAL;
+            field[n] = (uint8_t*) s;
+            oldWidth[n] = v - s;
+            newWidth[n] = length_size(newLen[n]);
+            if (delta > 0 && newWidth[n] < oldWidth[n])
+                newWidth[n] = oldWidth[n];
+            delta += newWidth[n] - oldWidth[n];
+        }
+        n++;
+    }
+
+    // Check that the whole message still fits
+    if (delta > cap - *len)
+        return ETLV_ERR_NOMEM;
+
+    // The bytes after the length field of chain[c] shift by the width changes
+    // of it and everything outside of it, the bytes after the value by delta
+    int shift[ETLV_PATCH_MAX_DEPTH + 2];
+    shift[n] = 0;
+    for (int c = n - 1; c >= 0; c--)
+        shift[c] = shift[c+1] + newWidth[c] - oldWidth[c];
+
+    // Move the tail once, then the bytes between the length fields. Growth
+    // moves the innermost bytes first, shrinking the outermost.
+    uint8_t* const TAIL = V + node->tok.len;
+    if (delta > 0)
+        move_bytes(TAIL + delta, TAIL, END-TAIL);
+    for (int i = 1; i < n; i++) {
+        const int c = delta > 0 ? i : n - i;
+        uint8_t* v = field[c] + oldWidth[c];
+        move_bytes(v + shift[c], v, field[c-1] - v);
+    }
+    if (delta < 0)
+        move_bytes(TAIL + delta, TAIL, END-TAIL);
+
+    // Write the new length fields and the value
+    for (int c = 0; c < n; c++)
+        if (newWidth[c])
+            encode_length_width(field[c] + shift[c+1], newWidth[c], newLen[c]);
+    copy_bytes(V + shift[0], val, valLen);
+
+    // Move the nodes along with their bytes
+    for (int k = chain[n-1], c = n - 1; k < nNodes; k++) {
+        while (c > 0 && k >= chain[c-1])
+            c--;
+        int s = k > idx ? delta : shift[c];
+        nodes[k].tok.val = (const uint8_t*) nodes[k].tok.val + s;
+    }
+    for (int c = 0; c < n; c++)
+        nodes[chain[c]].tok.len = newLen[c];
+
+    // Return the new length of the data
+    return *len += delta;
+}
+
+ETLV_API int etlv_serialize_iov(ETLVIovec* iov, int* nIov, void* hdr,
+                                int* hdrLen, const ETLVToken* t, int nTok)
+{
+    if (!iov || !nIov || *nIov < 0 || !hdr || !hdrLen || *hdrLen < 0 || !t ||
+        nTok < 0)
+        return ETLV_ERR_BADARG;
+
+    uint8_t* d = hdr;
+    const uint8_t* const BEGIN = d;
+    const uint8_t* const END = d + *hdrLen;
+
+    uint64_t total = 0;
+    int n = 0;
+    int err = 0;
+    for (int i = 0; i < nTok; i++) {
+        uint8_t* const h = d;
+
+        // Write the tag and length fields into the header buffer
+        err = encode_tag(&d, END-d, t[i].tag);
+        if (err < 0)
+            return err;
+        err = encode_length(&d, END-d, t[i].len);
+        if (err < 0)
+            return err;
+
+        // Extend the previous header entry if it ends right here
+        if (n > 0 && (const uint8_t*) iov[n-1].base + iov[n-1].len == h) {
+            iov[n-1].len += d-h;
+        } else {
+            if (n >= *nIov)
+                return ETLV_ERR_NOMEM;
+            iov[n].base = h;
+            iov[n].len = d-h;
+            n++;
+        }
+
+        // Point at the value, instead of copying it
+        if (t[i].len > 0) {
+            if (n >= *nIov)
+                return ETLV_ERR_NOMEM;
+            iov[n].base = t[i].val;
+            iov[n].len = t[i].len;
+            n++;
+        }
+
+        total += (d-h) + (uint64_t) t[i].len;
+        if (total > INT32_MAX)
+            return ETLV_ERR_OVERFLOW;
+    }
+
+    *nIov = n;
+    *hdrLen = d-BEGIN;
+
+    // Return total serialized length
+    return total;
+}
+
+ETLV_API int etlv_find(ETLVToken* t, uint32_t tag, const void* src, int srcLen)
+{
+    if (!t || !src || srcLen < 0)
+        return ETLV_ERR_BADARG;
+
+    const uint8_t* s = src;
+    const uint8_t* const BEGIN = s;
+    const uint8_t* const END = s + srcLen;
+
+    int err = 0;
+    int match = 0;
+    uint32_t found = 0;
+    uint32_t len = 0;
+    int offset = 0;
+    uint32_t scanned = 0;
+    while (!match && s < END) {
+        // Quickly skip short objects, which cannot match
+        scanned += skip_short(&s, END, tag);
+        if (s >= END)
+            break;
+
+        offset = s-BEGIN;
+        err = decode_header(&found, &len, &s, END);
+        if (err < 0)
+            break;
+        err = resolve_length(found, &len, s, END);
+        if (err < 0)
+            break;
+        ETLV_LOG("Found tag: 0x%08X\n\r", found);
+        ETLV_TRACE(((ETLVToken) {found, len, s}), s-BEGIN);
+        scanned++;
+        match = found == tag;
+        if (!match)
+            s += len + err;
+    }
+
+    ETLV_STAT(tokens, scanned);
+    ETLV_STAT(finds, 1);
+    ETLV_STAT(findScanned, scanned);
+    ETLV_STAT_MAX(findMaxScan, scanned);
+    ETLV_STAT(bytes, (s < END ? s : END) - BEGIN);
+
+    if (err < 0)
+        return ETLV_STAT_ERR(err);
+
+    if (!match)
+        return ETLV_STAT_ERR(ETLV_ERR_NOENT);
+
+    // Output a token for the found tag
+    t->tag = found;
+    t->len = len;
+    t->val = s;
+
+    // Return the byte offset of the found token
+    return offset;
+}
+
+// Check that a header of hdrLen bytes uses the shortest possible encoding
+static inline int is_minimal(const uint8_t* hdr, uint32_t tag, uint32_t length,
+                             int hdrLen)
+{
+    int tagLen = 1;
+    if ((hdr[0] & 0x1F) > 30) { // Extended tag
+        tagLen = min_size(tag);
+
+        // Low tag numbers need no extension, and the tag number must not be
+        // padded with leading zero bits
+        if ((tagLen == 2 && (tag & 0x7F) < 31) || hdr[1] == 0x80)
+            return 0;
+    }
+
+    const int LEN_LEN = length > 0x7F ? 1 + min_size(length) : 1;
+    return hdrLen - tagLen == LEN_LEN;
+}
+
+// An end-of-contents (00 00) closing the value of an indefinite length
+static inline int is_eoc(const uint8_t* s, const uint8_t* const END)
+{
+    return END-s >= 2 && s[0] == 0 && s[1] == 0;
+}
+
+// Validate one level of TLV objects and everything nested inside of them
+// A level of indefinite length is closed by its end-of-contents, and until
+// then END is the end of its parent. Like in etlv_parse_tree, the value is
+// then walked once, rather than once more for each level it is nested in.
+// Modifies src to point to the end of the data, or to the offending object
+// (NULL for a missing end-of-contents, which is reported by the caller)
+// Returns number of objects found, or negative error
+static int validate_level(const uint8_t** src, const uint8_t* const END,
+                          int indef, int depth, int maxDepth, int flags)
+{
+    const uint8_t* s = *src;
+
+    int n = 0;
+    int err = 0;
+    uint32_t tag;
+    uint32_t len;
+    while (!indef || !is_eoc(s, END)) {
+        if (s >= END) {
+            if (!indef)
+                break;
+            *src = NULL;
+            return ETLV_ERR_MSGSIZE; // End-of-contents is missing
+        }
+
+        // Report this object, if it turns out to be invalid
+        const uint8_t* const HDR = s;
+        *src = HDR;
+
+        err = decode_header(&tag, &len, &s, END);
+        if (err < 0)
+            return err;
+        if (flags & ETLV_VALIDATE_MINIMAL &&
+            (is_indefinite(len, s) || !is_minimal(HDR, tag, len, s-HDR)))
+            return ETLV_ERR_INVAL;
+        const int INDEF = is_indefinite(len, s);
+        if (INDEF && !is_constructed(tag)) // Primitive values need a length
+            return ETLV_ERR_INVAL;
+        if (!INDEF && len > (uint32_t)(END-s)) // Value exceeds its parent
+            return ETLV_ERR_MSGSIZE;
+        n++;
+
+        if (INDEF ? !is_eoc(s, END) : is_constructed(tag) && len > 0) {
+            if (depth >= maxDepth)
+                return ETLV_ERR_OVERFLOW;
+
+            const uint8_t* c = s;
+            err = validate_level(&c, INDEF ? END : s + len, INDEF, depth + 1,
+                                 maxDepth, flags);
+            if (err < 0) {
+                *src = c ? c : HDR;
+                return err;
+            }
+            if (n + err < n)
+                return ETLV_ERR_OVERFLOW;
+            n += err;
+            if (INDEF) // The value, without its end-of-contents
+                len = c - s - 2;
+        }
+        s += len + (INDEF ? 2 : 0);
+    }
+
+    // Step past the end-of-contents closing this level
+    *src = indef ? s + 2 : s;
+    return n;
+}
+
+ETLV_API int etlv_validate(int* errOff, const void* src, int srcLen,
+                           int maxDepth, int flags)
+{
+    if (!src || srcLen < 0 || maxDepth < 0)
+        return ETLV_ERR_BADARG;
+
+    const uint8_t* s = src;
+    const uint8_t* const BEGIN = s;
+
+    int n = validate_level(&s, BEGIN + srcLen, 0, 0, maxDepth, flags);
+    ETLV_STAT(tokens, n >= 0 ? n : 0);
+    ETLV_STAT(bytes, srcLen);
+
+    // Output the offset of the offending object
+    if (n < 0 && errOff)
+        *errOff = s-BEGIN;
+
+    return ETLV_STAT_ERR(n);
+}
+
+ETLV_API int etlv_serialized_size(const ETLVToken* t, int nTok)
+{
+    if (!t || nTok < 0)
+        return ETLV_ERR_BADARG;
+
+    uint64_t size = 0;
+    int err = 0;
+    for (int i = 0; i < nTok; i++) {
+        err = tag_size(t[i].tag);
+        if (err < 0)
+            return err;
+        size += err;
+
+        err = length_size(t[i].len);
+        if (err < 0)
+            return err;
+        size += err + (uint64_t) t[i].len;
+
+        // Make sure the total still fits in the return value
+        if (size > INT32_MAX)
+            return ETLV_ERR_OVERFLOW;
+    }
+
+    return size;
+}
+
+ETLV_API int etlv_find_many(ETLVToken* t, const uint32_t* tags, int nTags,
+                            const void* src, int srcLen)
+{
+    if (!t || !tags || nTags < 0 || !src || srcLen < 0)
+        return ETLV_ERR_BADARG;
+
+    const uint8_t* s = src;
+    const uint8_t* const END = s + srcLen;
+
+    // Mark every tag as not found
+    for (int i = 0; i < nTags; i++) {
+        t[i].tag = tags[i];
+        t[i].len = 0;
+        t[i].val = 0;
+    }
+
+    int err;
+    uint32_t found;
+    uint32_t len;
+    int nFound = 0;
+    while (s < END && nFound < nTags) {
+        err = decode_header(&found, &len, &s, END);
+        if (err < 0)
+            return err;
+        err = resolve_length(found, &len, s, END);
+        if (err < 0)
+            return err;
+        if (len > (uint32_t)(END-s))
+            return ETLV_ERR_MSGSIZE;
+
+        // Output a token for each request of this tag not yet found
+        for (int i = 0; i < nTags; i++) {
+            if (t[i].val || tags[i] != found)
+                continue;
+            t[i].len = len;
+            t[i].val = s;
+            nFound++;
+        }
+        s += len + err;
+    }
+
+    // Return the number of tags found
+    return nFound;
+}
+
+// Compare index entries by tag, then by offset
+static inline int index_less(const ETLVIndexEntry* a, const ETLVIndexEntry* b)
+{
+    return a->tag < b->tag || (a->tag == b->tag && a->offset < b->offset);
+}
+
+// Restore the heap property below entry i, for a heap of n entries
+static void index_sift(ETLVIndexEntry* e, int i, int n)
+{
+    ETLVIndexEntry tmp;
+    while (2*i + 1 < n) {
+        int c = 2*i + 1;
+        if (c + 1 < n && index_less(&e[c], &e[c + 1]))
+            c++;
+        if (!index_less(&e[i], &e[c]))
+            break;
+        tmp = e[i];
+        e[i] = e[c];
+        e[c] = tmp;
+        i = c;
+    }
+}
+
+ETLV_API int etlv_index_build(ETLVIndex* idx, ETLVIndexEntry* e, int nEntries,
+                              const void* src, int srcLen)
+{
+    if (!idx || !e || nEntries < 0 || !src || srcLen < 0)
+        return ETLV_ERR_BADARG;
+
+    const uint8_t* s = src;
+    const uint8_t* const BEGIN = s;
+    const uint8_t* const END = s + srcLen;
+
+    idx->src = src;
+    idx->e = e;
+    idx->n = 0;
+
+    int n = 0;
+    int err = 0;
+    while (s < END) {
+        if (n >= nEntries)
+            return ETLV_ERR_NOMEM;
+
+        e[n].offset = s-BEGIN;
+        err = decode_header(&e[n].tag, &e[n].len, &s, END);
+        if (err < 0)
+            return err;
+        err = resolve_length(e[n].tag, &e[n].len, s, END);
+        if (err < 0)
+            return err;
+        if (e[n].len > (uint32_t)(END-s))
+            return ETLV_ERR_MSGSIZE;
+        e[n].valOffset = s-BEGIN;
+        s += e[n].len + err;
+        n++;
+    }
+
+    // Heapsort the entries, so lookups can use a binary search
+    ETLVIndexEntry tmp;
+    for (int i = n/2 - 1; i >= 0; i--)
+        index_sift(e, i, n);
+    for (int i = n - 1; i > 0; i--) {
+        tmp = e[0];
+        e[0] = e[i];
+        e[i] = tmp;
+        index_sift(e, 0, i);
+    }
+
+    return idx->n = n;
+}
+
+ETLV_API int etlv_index_find(ETLVToken* t, const ETLVIndex* idx, uint32_t tag,
+                             int nth)
+{
+    if (!t || !idx || !idx->e || nth < 0)
+        return ETLV_ERR_BADARG;
+
+    // Find the first entry with a matching tag
+    int lo = 0;
+    int hi = idx->n;
+    while (lo < hi) {
+        int mid = lo + (hi - lo)/2;
+        if (idx->e[mid].tag < tag)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    // Entries of the same tag are sorted by offset
+    if (nth >= idx->n - lo || idx->e[lo + nth].tag != tag)
+        return ETLV_ERR_NOENT;
+
+    // Output a token for the found tag
+    const ETLVIndexEntry* found = &idx->e[lo + nth];
+    t->tag = found->tag;
+    t->len = found->len;
+    t->val = idx->src + found->valOffset;
+
+    // Return the byte offset of the found token
+    return found->offset;
+}
+
+// Decoder states of an ETLVStream
+enum {
+    STREAM_TAG = 0,     // Expecting the first tag octet
+    STREAM_TAG_FIRST,   // Expecting the first subsequent tag octet
+    STREAM_TAG_EXT,     // Expecting further subsequent tag octets
+    STREAM_LEN,         // Expecting the first length octet
+    STREAM_LEN_LONG,    // Expecting further long form length octets
+    STREAM_VAL,         // Inside of a value split across chunks
+};
+
+ETLV_API void etlv_iter_init(ETLVIter* it, const void* src, int srcLen)
+{
+    if (!it)
+        return;
+
+    it->base = src;
+    it->pos = src;
+    it->end = it->pos + (src && srcLen > 0 ? srcLen : 0);
+    it->cur.tag = 0;
+    it->cur.len = 0;
+    it->cur.val = 0;
+    it->err = (!src || srcLen < 0) ? ETLV_ERR_BADARG : ETLV_ERR_OK;
+}
+
+ETLV_API int etlv_iter_next(ETLVIter* it, ETLVToken* t)
+{
+    if (!it || !t)
+        return ETLV_ERR_BADARG;
+    if (it->err < 0)
+        return it->err;
+    if (it->pos >= it->end)
+        return ETLV_ERR_NOENT;
+
+    const uint8_t* s = it->pos;
+    const uint8_t* const HDR = s;
+    ETLVToken tok;
+    int err = decode_header(&tok.tag, &tok.len, &s, it->end);
+    if (err >= 0)
+        err = resolve_length(tok.tag, &tok.len, s, it->end);
+    if (err >= 0 && tok.len > (uint32_t)(it->end - s)) // Value exceeds level
+        err = ETLV_ERR_MSGSIZE;
+    if (err < 0)
+        return it->err = ETLV_STAT_ERR(err);
+    ETLV_STAT(tokens, 1);
+
+    // Move onto the next sibling, past any end-of-contents. Both tokens are
+    // written from the local one, as reading back the cursor's token would
+    // stall on the stores just made to it.
+    tok.val = s;
+    it->cur = tok;
+    it->pos = s + tok.len + err;
+    *t = tok;
+
+    // Return the byte offset of the object
+    return HDR - it->base;
+}
+
+ETLV_API int etlv_iter_enter(const ETLVIter* it, ETLVIter* child)
+{
+    if (!it || !child)
+        return ETLV_ERR_BADARG;
+    if (it->err < 0)
+        return it->err;
+    if (!it->cur.val || !is_constructed(it->cur.tag))
+        return ETLV_ERR_INVAL;
+
+    // Copy the object first, the child may be the parent cursor
+    const uint8_t* const V = it->cur.val;
+    const uint32_t LEN = it->cur.len;
+    child->base = it->base;
+    child->pos = V;
+    child->end = V + LEN;
+    child->cur.tag = 0;
+    child->cur.len = 0;
+    child->cur.val = 0;
+    child->err = ETLV_ERR_OK;
+    return ETLV_ERR_OK;
+}
+
+ETLV_API int etlv_iter_skip(ETLVIter* it, int n)
+{
+    if (!it || n < 0)
+        return ETLV_ERR_BADARG;
+
+    ETLVToken t;
+    int i = 0;
+    while (i < n) {
+        int err = etlv_iter_next(it, &t);
+        if (err == ETLV_ERR_NOENT)
+            break;
+        if (err < 0)
+            return err;
+        i++;
+    }
+
+    // Return the number of objects skipped
+    return i;
+}
+
+ETLV_API void etlv_stream_init(ETLVStream* st, ETLVStreamCb cb, void* ctx)
+{
+    if (!st)
+        return;
+
+    st->cb = cb;
+    st->ctx = ctx;
+    st->tag = 0;
+    st->len = 0;
+    st->remain = 0;
+    st->state = STREAM_TAG;
+    st->err = ETLV_ERR_OK;
+    st->pos = 0;
+    st->depth = 0;
+}
+
+// Handle a completely decoded header
+// Emits the whole token if its value is available, otherwise begins a split value
+static inline int stream_header(ETLVStream* st, const uint8_t** src,
+                                const uint8_t* const END)
+{
+    ETLVToken tok = {.tag = st->tag, .len = st->len, .val = 0};
+    ETLV_STAT(tokens, 1);
+    ETLV_STAT(extTags, st->tag > 0xFF);
+
+    if (st->len <= (uint32_t)(END - *src)) {
+        tok.val = *src;
+        *src += st->len;
+        st->state = STREAM_TAG;
+        return st->cb(st->ctx, ETLV_STREAM_TOKEN, &tok);
+    }
+
+    st->remain = st->len;
+    st->state = STREAM_VAL;
+    return st->cb(st->ctx, ETLV_STREAM_BEGIN, &tok);
+}
+
+// Handle the header of an indefinite length object, whose value starts at
+// stream offset pos. Its contents are decoded as objects of their own.
+static int stream_open(ETLVStream* st, uint64_t pos)
+{
+    if (!is_constructed(st->tag)) // Primitive values need a definite length
+        return ETLV_ERR_INVAL;
+    if (st->depth >= ETLV_STREAM_MAX_DEPTH)
+        return ETLV_ERR_OVERFLOW;
+
+    st->open[st->depth] = st->tag;
+    st->start[st->depth++] = pos;
+    st->state = STREAM_TAG;
+
+    ETLVToken tok = {.tag = st->tag, .len = 0, .val = 0};
+    return st->cb(st->ctx, ETLV_STREAM_BEGIN, &tok);
+}
+
+// Handle an end-of-contents at stream offset pos, closing the innermost
+// indefinite length object
+static int stream_close(ETLVStream* st, uint64_t pos)
+{
+    st->depth--;
+    st->state = STREAM_TAG;
+    if (pos - st->start[st->depth] > INT32_MAX)
+        return ETLV_ERR_OVERFLOW;
+
+    ETLVToken tok = {.tag = st->open[st->depth], .val = 0};
+    tok.len = pos - st->start[st->depth];
+    return st->cb(st->ctx, ETLV_STREAM_END, &tok);
+}
+
+ETLV_API int etlv_stream_feed(ETLVStream* st, const void* src, int srcLen)
+{
+    if (!st || !st->cb || !src || srcLen < 0)
+        return ETLV_ERR_BADARG;
+    if (st->err < 0)
+        return st->err;
+
+    const uint8_t* s = src;
+    const uint8_t* const BEGIN = s;
+    const uint8_t* const END = s + srcLen;
+
+    ETLVToken tok;
+    uint32_t n;
+    int err = 0;
+    while (s < END && err >= 0) {
+        switch (st->state) {
+        case STREAM_TAG:
+            st->tag = *s;
+            st->state = (*s++ & 0x1F) > 30 ? STREAM_TAG_FIRST : STREAM_LEN;
+            break;
+
+        case STREAM_TAG_FIRST:
+            // First subsequent octet must not be 0
+            if (*s == 0) {
+                err = ETLV_ERR_INVAL;
+                break;
+            }
+            // fall through
+        case STREAM_TAG_EXT:
+            // Detect overflow, a fifth octet would shift out the first
+            if (st->tag > 0x00FFFFFF) {
+                err = ETLV_ERR_OVERFLOW;
+                break;
+            }
+
+            // Join each octet of the tag, the last octet will clear MSB
+            st->tag = (st->tag << 8) + *s;
+            st->state = *s++ & 0x80 ? STREAM_TAG_EXT : STREAM_LEN;
+            break;
+
+        case STREAM_LEN:
+            if (*s & 0x80) { // Is the length in long form?
+                // The first byte must not be 0xFF
+                if (*s == 0xFF) {
+                    err = ETLV_ERR_INVAL;
+                    break;
+                }
+
+                st->remain = *s++ & 0x7F; // Number of length bytes to use
+                if (st->remain > 4) {
+                    err = ETLV_ERR_OVERFLOW;
+                    break;
+                }
+                st->len = 0;
+                if (st->remain) {
+                    st->state = STREAM_LEN_LONG;
+                    break;
+                }
+
+                // No length octets, so the length is indefinite
+                err = stream_open(st, st->pos + (s-BEGIN));
+                break;
+            }
+            st->len = *s++;
+            if (st->depth && st->tag == 0 && st->len == 0) {
+                // End-of-contents of an indefinite length object
+                err = stream_close(st, st->pos + (s-BEGIN) - 2);
+                break;
+            }
+            err = stream_header(st, &s, END);
+            break;
+
+        case STREAM_LEN_LONG:
+            // Length must fit in a signed int
+            if (st->remain == 4 && *s & 0x80) {
+                err = ETLV_ERR_OVERFLOW;
+                break;
+            }
+            st->len = (st->len << 8) + *s++;
+            if (--st->remain == 0)
+                err = stream_header(st, &s, END);
+            break;
+
+        case STREAM_VAL:
+            // Deliver as much of the value as this chunk holds
+            n = st->remain < (uint32_t)(END-s) ? st->remain : (uint32_t)(END-s);
+            tok.tag = st->tag;
+            tok.len = n;
+            tok.val = s;
+            s += n;
+            st->remain -= n;
+            err = st->cb(st->ctx, ETLV_STREAM_DATA, &tok);
+            if (err < 0 || st->remain)
+                break;
+
+            tok.len = st->len;
+            tok.val = 0;
+            st->state = STREAM_TAG;
+            err = st->cb(st->ctx, ETLV_STREAM_END, &tok);
+            break;
+
+        default:
+            err = ETLV_ERR_UNKNOWN;
+            break;
+        }
+    }
+
+    // Errors are sticky, the stream cannot resynchronize
+    ETLV_STAT(bytes, s-BEGIN);
+    if (err < 0)
+        return st->err = ETLV_STAT_ERR(err);
+    st->pos += srcLen;
+
+    // Return the number of bytes consumed
+    return srcLen;
+}
+
+ETLV_API int etlv_stream_finish(const ETLVStream* st)
+{
+    if (!st)
+        return ETLV_ERR_BADARG;
+    if (st->err < 0)
+        return st->err;
+
+    switch (st->state) {
+    case STREAM_TAG: // The end-of-contents of an object may be missing
+        return st->depth ? ETLV_ERR_MSGSIZE : ETLV_ERR_OK;
+    case STREAM_VAL: // TLV data exceeds the data provided
+        return ETLV_ERR_MSGSIZE;
+    default: // Stream ended inside of a header
+        return ETLV_ERR_NODATA;
+    }
+}
+
+ETLV_API void etlv_writer_init(ETLVWriter* w, void* dest, int destLen)
+{
+    if (!w)
+        return;
+
+    w->buf = dest;
+    w->cap = destLen;
+    w->pos = 0;
+    w->depth = 0;
+    w->err = (!dest || destLen < 0) ? ETLV_ERR_BADARG : ETLV_ERR_OK;
+}
+
+ETLV_API int etlv_writer_add(ETLVWriter* w, const ETLVToken* t)
+{
+    if (!w)
+        return ETLV_ERR_BADARG;
+    if (w->err < 0)
+        return w->err;
+    if (!t)
+        return w->err = ETLV_ERR_BADARG;
+
+    int len = w->cap - w->pos;
+    int err = etlv_serialize(w->buf + w->pos, &len, t, 1);
+    if (err < 0)
+        return w->err = err;
+
+    return w->pos += len;
+}
+
+ETLV_API int etlv_writer_begin_constructed(ETLVWriter* w, uint32_t tag,
+                                           uint32_t sizeHint)
+{
+    if (!w)
+        return ETLV_ERR_BADARG;
+    if (w->err < 0)
+        return w->err;
+    if (w->depth >= ETLV_WRITER_MAX_DEPTH)
+        return w->err = ETLV_ERR_OVERFLOW;
+
+    uint8_t* d = w->buf + w->pos;
+    int err = encode_tag(&d, w->cap - w->pos, tag);
+    if (err < 0)
+        return w->err = err;
+    w->pos += err;
+
+    // Reserve room for the length, it is written once the value is complete.
+    // A 32 bit length never needs more than 5 bytes.
+    const int width = sizeHint ? length_size(sizeHint) : 1;
+    if (width > w->cap - w->pos)
+        return w->err = ETLV_ERR_NOMEM;
+    w->open[w->depth] = w->pos;
+    w->width[w->depth] = width;
+    w->depth++;
+
+    return w->pos += width;
+}
+
+ETLV_API int etlv_writer_end(ETLVWriter* w)
+{
+    if (!w)
+        return ETLV_ERR_BADARG;
+    if (w->err < 0)
+        return w->err;
+    if (w->depth <= 0)
+        return w->err = ETLV_ERR_INVAL;
+
+    w->depth--;
+    const int OPEN = w->open[w->depth];
+    const int WIDTH = w->width[w->depth];
+    const uint32_t LEN = w->pos - OPEN - WIDTH;
+
+    const int width = length_size(LEN);
+
+    // Shift the value once, if the reserved length field has the wrong width
+    if (width != WIDTH) {
+        if (width - WIDTH > w->cap - w->pos)
+            return w->err = ETLV_ERR_NOMEM;
+        move_bytes(w->buf + OPEN + width, w->buf + OPEN + WIDTH, LEN);
+        w->pos += width - WIDTH;
+    }
+
+    uint8_t* d = w->buf + OPEN;
+    int err = encode_length(&d, width, LEN);
+    if (err < 0)
+        return w->err = err;
+
+    return w->pos;
+}
+
+ETLV_API int etlv_writer_finish(const ETLVWriter* w)
+{
+    if (!w)
+        return ETLV_ERR_BADARG;
+    if (w->err < 0)
+        return w->err;
+    if (w->depth != 0) // Constructed object left open
+        return ETLV_ERR_INVAL;
+
+    // Return total serialized length
+    return w->pos;
+}
+
+ETLV_API int64_t etlv_parse_ex(ETLVTokenEx* t, size_t* nTok, const void* src,
+                               size_t srcLen)
+{
+    if (!nTok || !src || srcLen > INT64_MAX)
+        return ETLV_ERR_BADARG;
+
+    const uint8_t* s = src;
+    const uint8_t* const BEGIN = s;
+    const uint8_t* const END = s + srcLen;
+
+    // Without a token array, only count the tokens
+    const size_t MAX_TOK = t ? *nTok : 0;
+
+    ETLVTokenEx tok;
+    size_t n = 0;
+    int err = 0;
+    while (s < END) {
+        err = decode_header_ex(&tok.tag, &tok.len, &s, END);
+        if (err < 0)
+            return err;
+
+        // TLV data exceeds byte array provided
+        if (tok.len > (uint64_t)(END-s))
+            return ETLV_ERR_MSGSIZE;
+
+        // Store the token, if there is room for it
+        tok.val = s;
+        if (n < MAX_TOK)
+            t[n] = tok;
+
+        // Point to next object
+        s += tok.len;
+        n++;
+    }
+
+    // Output the number of tokens found
+    *nTok = n;
+    if (t && n > MAX_TOK) // Token array was too small
+        return ETLV_ERR_NOMEM;
+
+    // Return the total length of the TLV data
+    return s-BEGIN;
+}
+
+ETLV_API int64_t etlv_serialize_ex(void* dest, size_t* len,
+                                   const ETLVTokenEx* t, size_t nTok)
+{
+    if (!dest || !len || *len > INT64_MAX || !t)
+        return ETLV_ERR_BADARG;
+
+    uint8_t* d = dest;
+    const uint8_t* const BEGIN = d;
+    const uint8_t* const END = d + *len;
+
+    *len = 0;
+    int err = 0;
+    for (size_t i = 0; i < nTok; i++) {
+        // Write the tag field
+        const size_t REMAIN = END-d;
+        err = encode_tag(&d, REMAIN < 16 ? (int) REMAIN : 16, t[i].tag);
+        if (err < 0)
+            return err;
+
+        // Write the length field
+        err = encode_length_ex(&d, END-d, t[i].len);
+        if (err < 0)
+            return err;
+
+        // Make sure not to overrun the buffer
+        if (t[i].len > (uint64_t)(END-d))
+            return ETLV_ERR_NOMEM;
+        copy_bytes(d, t[i].val, t[i].len);
+        d += t[i].len;
+    }
+
+    // Return total serialized length
+    return *len = d-BEGIN;
+}
+
+ETLV_API int64_t etlv_find_ex(ETLVTokenEx* t, uint32_t tag, const void* src,
+                              size_t srcLen)
+{
+    if (!t || !src || srcLen > INT64_MAX)
+        return ETLV_ERR_BADARG;
+
+    const uint8_t* s = src;
+    const uint8_t* const BEGIN = s;
+    const uint8_t* const END = s + srcLen;
+
+    int err = 0;
+    uint32_t found;
+    uint64_t len;
+    while (s < END) {
+        // Quickly skip short objects, which cannot match, but the last one
+        // skipped may still run past the end
+        skip_short(&s, END, tag);
+        if (s > END)
+            return ETLV_ERR_MSGSIZE;
+        if (s == END)
+            break;
+
+        const uint8_t* const HDR = s;
+        err = decode_header_ex(&found, &len, &s, END);
+        if (err < 0)
+            return err;
+        if (found == tag) {
+            // Output a token for the found tag
+            t->tag = found;
+            t->len = len;
+            t->val = s;
+
+            // Return the byte offset of the found token
+            return HDR-BEGIN;
+        }
+        if (len > (uint64_t)(END-s))
+            return ETLV_ERR_MSGSIZE;
+        s += len;
+    }
+
+    return ETLV_ERR_NOENT;
+}
+
+ETLV_API int etlv_file_map(ETLVFile* f, const void* base, size_t size)
+{
+    if (!f || (!base && size) || size > INT64_MAX)
+        return ETLV_ERR_BADARG;
+
+    f->base = base;
+    f->size = size;
+    f->fd = -1;
+    return ETLV_ERR_OK;
+}
+
+#ifdef ETLV_USE_MMAP
+ETLV_API int etlv_file_open(ETLVFile* f, const char* path)
+{
+    if (!f || !path)
+        return ETLV_ERR_BADARG;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return ETLV_ERR_NOENT;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < 0) {
+        close(fd);
+        return ETLV_ERR_UNKNOWN;
+    }
+
+    const size_t SIZE = st.st_size;
+    void* base = 0;
+    if (SIZE > 0) {
+        base = mmap(0, SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base == MAP_FAILED) {
+            close(fd);
+            return ETLV_ERR_NOMEM;
+        }
+
+        // Objects are visited out of order, so read-ahead would only fault in
+        // pages which are never accessed
+        posix_madvise(base, SIZE, POSIX_MADV_RANDOM);
+    }
+
+    f->base = base;
+    f->size = SIZE;
+    f->fd = fd;
+    return ETLV_ERR_OK;
+}
+
+ETLV_API void etlv_file_close(ETLVFile* f)
+{
+    if (!f)
+        return;
+
+    if (f->fd >= 0) {
+        if (f->size > 0)
+            munmap((void*) f->base, f->size);
+        close(f->fd);
+    }
+    f->base = 0;
+    f->size = 0;
+    f->fd = -1;
+}
+#endif /* ETLV_USE_MMAP */
+
+// Find the data of a file, or of an object inside of the file
+// Returns ETLV_ERR_OK, or negative error
+static inline int file_span(const uint8_t** src, size_t* srcLen,
+                            const ETLVFile* f, const ETLVTokenEx* parent)
+{
+    if (!f || (!f->base && f->size))
+        return ETLV_ERR_BADARG;
+
+    if (!parent) {
+        *src = f->base;
+        *srcLen = f->size;
+        return ETLV_ERR_OK;
+    }
+
+    // The parent must lie inside of the mapping
+    const uint8_t* const V = parent->val;
+    if (!V || V < f->base || V > f->base + f->size ||
+        parent->len > (uint64_t)(f->base + f->size - V))
+        return ETLV_ERR_BADARG;
+
+    *src = V;
+    *srcLen = parent->len;
+    return ETLV_ERR_OK;
+}
+
+ETLV_API int64_t etlv_file_parse(ETLVTokenEx* t, size_t* nTok,
+                                 const ETLVFile* f, const ETLVTokenEx* parent)
+{
+    const uint8_t* src;
+    size_t srcLen;
+    int err = file_span(&src, &srcLen, f, parent);
+    if (err < 0)
+        return err;
+
+    return etlv_parse_ex(t, nTok, src, srcLen);
+}
+
+ETLV_API int64_t etlv_file_find(ETLVTokenEx* t, uint32_t tag, const ETLVFile* f,
+                                const ETLVTokenEx* parent)
+{
+    const uint8_t* src;
+    size_t srcLen;
+    int err = file_span(&src, &srcLen, f, parent);
+    if (err < 0)
+        return err;
+
+    int64_t off = etlv_find_ex(t, tag, src, srcLen);
+    if (off < 0)
+        return off;
+
+    // Return the offset from the start of the file
+    return (src - f->base) + off;
+}
+
+ETLV_API int etlv_trailer_encode(void* dest, size_t destLen, uint32_t recLen)
+{
+    if (!dest)
+        return ETLV_ERR_BADARG;
+    if (destLen < ETLV_TRAILER_SIZE)
+        return ETLV_ERR_NOMEM;
+
+    uint8_t* d = dest;
+    d[0] = ETLV_TAG_BYTE(ETLV_TRAILER_TAG, 0);
+    d[1] = ETLV_TAG_BYTE(ETLV_TRAILER_TAG, 1);
+    d[2] = 4;
+    d[3] = recLen >> 24;
+    d[4] = recLen >> 16;
+    d[5] = recLen >> 8;
+    d[6] = recLen;
+    return ETLV_TRAILER_SIZE;
+}
+
+// Read the trailer ending at END, if there is one
+// Returns the length of the record before it, or negative error
+static int64_t read_trailer(const uint8_t* const BEGIN, const uint8_t* const END)
+{
+    if (END-BEGIN < ETLV_TRAILER_SIZE)
+        return ETLV_ERR_NOENT;
+
+    const uint8_t* const T = END - ETLV_TRAILER_SIZE;
+    if (T[0] != ETLV_TAG_BYTE(ETLV_TRAILER_TAG, 0) ||
+        T[1] != ETLV_TAG_BYTE(ETLV_TRAILER_TAG, 1) || T[2] != 4)
+        return ETLV_ERR_NOENT;
+
+    const uint32_t LEN = (uint32_t) T[3] << 24 | T[4] << 16 | T[5] << 8 | T[6];
+    if (LEN > (uint64_t)(T-BEGIN)) // Record exceeds the log
+        return ETLV_ERR_INVAL;
+    return LEN;
+}
+
+ETLV_API void etlv_log_iter_init(ETLVLogIter* it, const void* src,
+                                 size_t srcLen)
+{
+    if (!it)
+        return;
+    it->src = src;
+    it->pos = src ? srcLen : 0;
+}
+
+ETLV_API int64_t etlv_log_iter_prev(ETLVLogIter* it, ETLVTokenEx* rec)
+{
+    if (!it || !rec)
+        return ETLV_ERR_BADARG;
+    if (it->pos == 0)
+        return ETLV_ERR_NOENT;
+
+    // Every record must end with a trailer
+    const uint8_t* const END = it->src + it->pos;
+    int64_t len = read_trailer(it->src, END);
+    if (len < 0)
+        return ETLV_ERR_INVAL;
+
+    it->pos -= ETLV_TRAILER_SIZE + len;
+    rec->tag = ETLV_TRAILER_TAG;
+    rec->len = len;
+    rec->val = it->src + it->pos;
+
+    // Return the byte offset of the record
+    return it->pos;
+}
+
+// Scan one level for the last occurance of a tag
+// Returns the byte offset of the found token, or negative error
+static int64_t find_last_level(ETLVTokenEx* t, uint32_t tag,
+                               const uint8_t* src, size_t srcLen)
+{
+    const uint8_t* s = src;
+    const uint8_t* const END = s + srcLen;
+
+    int64_t offset = ETLV_ERR_NOENT;
+    uint32_t found;
+    uint64_t len;
+    while (s < END) {
+        // Quickly skip short objects, which cannot match, but the last one
+        // skipped may still run past the end
+        skip_short(&s, END, tag);
+        if (s > END)
+            return ETLV_ERR_MSGSIZE;
+        if (s == END)
+            break;
+
+        const uint8_t* const HDR = s;
+        int err = decode_header_ex(&found, &len, &s, END);
+        if (err < 0)
+            return err;
+        if (len > (uint64_t)(END-s))
+            return ETLV_ERR_MSGSIZE;
+        if (found == tag) {
+            t->tag = found;
+            t->len = len;
+            t->val = s;
+            offset = HDR-src;
+        }
+        s += len;
+    }
+
+    return offset;
+}
+
+ETLV_API int64_t etlv_find_last_ex(ETLVTokenEx* t, uint32_t tag,
+                                   const void* src, size_t srcLen)
+{
+    if (!t || !src || srcLen > INT64_MAX)
+        return ETLV_ERR_BADARG;
+
+    const uint8_t* const BEGIN = src;
+
+    // Without a trailer, this is not a log
+    int64_t err = read_trailer(BEGIN, BEGIN + srcLen);
+    if (err == ETLV_ERR_NOENT)
+        return find_last_level(t, tag, BEGIN, srcLen);
+    if (err < 0)
+        return err;
+
+    // Search the newest record first
+    ETLVLogIter it;
+    ETLVTokenEx rec;
+    etlv_log_iter_init(&it, src, srcLen);
+    while ((err = etlv_log_iter_prev(&it, &rec)) >= 0) {
+        const int64_t OFF = find_last_level(t, tag, rec.val, rec.len);
+        if (OFF != ETLV_ERR_NOENT)
+            return OFF < 0 ? OFF : err + OFF;
+    }
+
+    return err;
+}
+
+ETLV_API int etlv_find_last(ETLVToken* t, uint32_t tag, const void* src,
+                            int srcLen)
+{
+    if (!t || srcLen < 0)
+        return ETLV_ERR_BADARG;
+
+    ETLVTokenEx tok;
+    int64_t off = etlv_find_last_ex(&tok, tag, src, srcLen);
+    if (off < 0)
+        return off;
+
+    // Every length fits, as the value lies inside of the source
+    t->tag = tok.tag;
+    t->len = tok.len;
+    t->val = tok.val;
+    return off;
+}
+
+ETLV_API int64_t etlv_file_find_last(ETLVTokenEx* t, uint32_t tag,
+                                     const ETLVFile* f,
+                                     const ETLVTokenEx* parent)
+{
+    const uint8_t* src;
+    size_t srcLen;
+    int err = file_span(&src, &srcLen, f, parent);
+    if (err < 0)
+        return err;
+
+    int64_t off = etlv_find_last_ex(t, tag, src, srcLen);
+    if (off < 0)
+        return off;
+
+    // Return the offset from the start of the file
+    return (src - f->base) + off;
+}
+
+// Alignment of every arena allocation
+#define ARENA_ALIGN 16
+
+ETLV_API void etlv_arena_init(ETLVArena* a, void* buf, size_t cap)
+{
+    if (!a)
+        return;
+
+    a->buf = buf;
+    a->cap = buf ? cap : 0;
+    a->used = 0;
+}
+
+ETLV_API void etlv_arena_reset(ETLVArena* a)
+{
+    if (a)
+        a->used = 0;
+}
+
+ETLV_API void* etlv_arena_alloc(ETLVArena* a, size_t size)
+{
+    if (!a || !a->buf)
+        return 0;
+
+    // Align the allocation from the real address of the buffer
+    const uintptr_t ADDR = (uintptr_t) a->buf + a->used;
+    const size_t PAD = (ARENA_ALIGN - ADDR % ARENA_ALIGN) % ARENA_ALIGN;
+    if (PAD > a->cap - a->used || size > a->cap - a->used - PAD)
+        return 0;
+
+    void* p = a->buf + a->used + PAD;
+    a->used += PAD + size;
+    return p;
+}
+
+// Allocator callbacks of an arena, memory is only returned by a reset
+static void* arena_alloc_cb(void* ctx, size_t size)
+{
+    return etlv_arena_alloc(ctx, size);
+}
+
+static void arena_free_cb(void* ctx, void* p)
+{
+    (void) ctx;
+    (void) p;
+}
+
+ETLV_API ETLVAllocator etlv_arena_allocator(ETLVArena* a)
+{
+    ETLVAllocator alloc = {
+        .alloc = arena_alloc_cb,
+        .free = arena_free_cb,
+        .ctx = a,
+    };
+    return alloc;
+}
+
+// Allocate an array of n elements of the given size
+static inline void* alloc_array(const ETLVAllocator* a, int n, size_t size)
+{
+    if (n <= 0)
+        n = 1; // Never hand out a NULL array for an empty result
+    if ((size_t) n > SIZE_MAX / size)
+        return 0;
+    return a->alloc(a->ctx, n * size);
+}
+
+ETLV_API int etlv_parse_alloc(ETLVToken** t, int* nTok, const void* src,
+                              int srcLen, const ETLVAllocator* a)
+{
+    if (!t || !nTok || !src || srcLen < 0 || !a || !a->alloc || !a->free)
+        return ETLV_ERR_BADARG;
+
+    // Count the tokens, then parse them into an array of the exact size
+    int n = 0;
+    int err = parse_level(NULL, &n, src, srcLen);
+    if (err < 0)
+        return err;
+
+    ETLVToken* tok = alloc_array(a, n, sizeof(*tok));
+    if (!tok)
+        return ETLV_ERR_NOMEM;
+
+    err = parse_level(tok, &n, src, srcLen);
+    if (err < 0) {
+        a->free(a->ctx, tok);
+        return err;
+    }
+
+    *t = tok;
+    *nTok = n;
+    return err;
+}
+
+ETLV_API int etlv_parse_tree_alloc(ETLVNode** nodes, int* nNodes,
+                                   const void* src, int srcLen,
+                                   const ETLVAllocator* a)
+{
+    if (!nodes || !nNodes || !src || srcLen < 0 || !a || !a->alloc || !a->free)
+        return ETLV_ERR_BADARG;
+
+    // Count the nodes, then parse them into an array of the exact size
+    int n = count_nodes(src, (const uint8_t*) src + srcLen);
+    if (n < 0)
+        return n;
+
+    ETLVNode* node = alloc_array(a, n, sizeof(*node));
+    if (!node)
+        return ETLV_ERR_NOMEM;
+
+    int err = etlv_parse_tree(node, &n, src, srcLen);
+    if (err == ETLV_ERR_NOMEM)
+        err = ETLV_ERR_INVAL; // Misplaced end-of-contents, see count_nodes
+    if (err < 0) {
+        a->free(a->ctx, node);
+        return err;
+    }
+
+    *nodes = node;
+    *nNodes = n;
+    return err;
+}
+
+ETLV_API int etlv_index_build_alloc(ETLVIndex* idx, const void* src, int srcLen,
+                                    const ETLVAllocator* a)
+{
+    if (!idx || !src || srcLen < 0 || !a || !a->alloc || !a->free)
+        return ETLV_ERR_BADARG;
+
+    // Count the objects, then index them into an array of the exact size
+    int n = 0;
+    int err = parse_level(NULL, &n, src, srcLen);
+    if (err < 0)
+        return err;
+
+    ETLVIndexEntry* e = alloc_array(a, n, sizeof(*e));
+    if (!e)
+        return ETLV_ERR_NOMEM;
+
+    err = etlv_index_build(idx, e, n, src, srcLen);
+    if (err < 0)
+        a->free(a->ctx, e);
+    return err;
+}
+
+ETLV_API int etlv_parse_compact(ETLVCompactToken* t, int* nTok, const void* src,
+                                int srcLen)
+{
+    if (!nTok || (t && *nTok < 0) || !src || srcLen < 0)
+        return ETLV_ERR_BADARG;
+
+    const uint8_t* s = src;
+    const uint8_t* const BEGIN = s;
+    const uint8_t* const END = s + srcLen;
+
+    // Without a token array, only count the tokens
+    const int MAX_TOK = t ? *nTok : 0;
+
+    ETLV_STAT(bytes, srcLen);
+
+    uint32_t tag;
+    uint32_t len;
+    int n = 0;
+    int err = 0;
+    while (s < END) {
+        err = decode_header(&tag, &len, &s, END);
+        if (err < 0)
+            return ETLV_STAT_ERR(err);
+        err = resolve_length(tag, &len, s, END);
+        if (err < 0)
+            return ETLV_STAT_ERR(err);
+
+        // Store the token, if there is room for it
+        if (n < MAX_TOK) {
+            t[n].tag = tag;
+            t[n].len = len;
+            t[n].off = s-BEGIN;
+        }
+
+        // Point to next object, past any end-of-contents
+        s += len + err;
+        n++;
+    }
+
+    // Output the number of tokens found
+    *nTok = n;
+    ETLV_STAT(tokens, n);
+
+    if (s > END) // TLV data exceeds byte array provided
+        return ETLV_STAT_ERR(ETLV_ERR_MSGSIZE);
+    if (t && n > MAX_TOK) // Token array was too small
+        return ETLV_STAT_ERR(ETLV_ERR_NOMEM);
+
+    // Return the total length of the TLV data
+    return s-BEGIN;
+}
+
+ETLV_API int etlv_find_compact(ETLVCompactToken* t, uint32_t tag,
+                               const void* src, int srcLen)
+{
+    if (!t)
+        return ETLV_ERR_BADARG;
+
+    ETLVToken tok;
+    int off = etlv_find(&tok, tag, src, srcLen);
+    if (off < 0)
+        return off;
+
+    t->tag = tok.tag;
+    t->len = tok.len;
+    t->off = (const uint8_t*) tok.val - (const uint8_t*) src;
+    return off;
+}
+
+ETLV_API int etlv_serialize_compact(void* dest, int* len,
+                                    const ETLVCompactToken* t, int nTok,
+                                    const void* base)
+{
+    if (!dest || !len || *len < 0 || !t || nTok < 0 || !base)
+        return ETLV_ERR_BADARG;
+
+    uint8_t* d = dest;
+    const uint8_t* const BEGIN = d;
+    const uint8_t* const END = d + *len;
+    const uint8_t* const BASE = base;
+
+    *len = 0;
+    int err = 0;
+    for (int i = 0; i < nTok; i++) {
+        // Write the tag and length fields
+        err = encode_tag(&d, END-d, t[i].tag);
+        if (err < 0)
+            return err;
+        err = encode_length(&d, END-d, t[i].len);
+        if (err < 0)
+            return err;
+
+        // Copy the value from its offset
+        if (t[i].len > (uint32_t)(END-d))
+            return ETLV_ERR_NOMEM;
+        copy_bytes(d, BASE + t[i].off, t[i].len);
+        d += t[i].len;
+    }
+
+    // Return total serialized length
+    return *len = d-BEGIN;
+}
+
+ETLV_API int etlv_encode_tag(ETLVEncodedTag* e, uint32_t tag)
+{
+    if (!e)
+        return ETLV_ERR_BADARG;
+
+    uint8_t* d = e->b;
+    int err = encode_tag(&d, sizeof(e->b), tag);
+    if (err < 0)
+        return err;
+
+    return e->n = err;
+}
+
+ETLV_API int etlv_serialize_encoded(void* dest, int* len,
+                                    const ETLVEncodedToken* t, int nTok)
+{
+    if (!dest || !len || *len < 0 || !t || nTok < 0)
+        return ETLV_ERR_BADARG;
+
+    uint8_t* d = dest;
+    const uint8_t* const BEGIN = d;
+    const uint8_t* const END = d + *len;
+
+    *len = 0;
+    int err = 0;
+    for (int i = 0; i < nTok; i++) {
+        // Copy the tag bytes, which were validated by etlv_encode_tag
+        const int N = t[i].tag.n;
+        if (N < 1 || N > 4)
+            return ETLV_ERR_INVAL;
+        if (N >= END-d)
+            return ETLV_ERR_NOMEM;
+        for (int j = 0; j < N; j++)
+            d[j] = t[i].tag.b[j];
+        d += N;
+
+        // Write the length field, short form lengths need no size computation
+        if (t[i].len < 0x80) {
+            *d++ = t[i].len;
+        } else {
+            err = encode_length(&d, END-d, t[i].len);
+            if (err < 0)
+                return err;
+        }
+
+        // Copy the value
+        if (t[i].len > (uint32_t)(END-d))
+            return ETLV_ERR_NOMEM;
+        copy_bytes(d, t[i].val, t[i].len);
+        d += t[i].len;
+    }
+
+    // Return total serialized length
+    return *len = d-BEGIN;
+}
+
+// Decode the fields of a schema from one level of TLV data
+// Returns length of the decoded data, or negative error
+static int schema_decode(const ETLVSchema* sch, uint8_t* out, const uint8_t* s,
+                         const uint8_t* const END)
+{
+    if (!sch || !sch->f || sch->nFields < 0)
+        return ETLV_ERR_BADARG;
+
+    const uint8_t* const BEGIN = s;
+
+    int err = 0;
+    uint32_t len;
+    const uint8_t* v;
+    for (int i = 0; i < sch->nFields; i++) {
+        const ETLVField* f = &sch->f[i];
+
+#ifndef ETLV_NO_FAST_PATH
+        // Fast path for a single byte tag followed by a short form length
+        if (f->encLen == 1 && END-s >= 2 && s[0] == f->enc[0] &&
+            !(s[1] & 0x80)) {
+            len = s[1];
+            v = s+2;
+            if (len > (uint32_t)(END-v))
+                return ETLV_ERR_MSGSIZE;
+            s = v + len;
+        } else
+#endif
+        {
+            // Compare the encoded tag, which is followed by at least a length
+            int match = END-s > f->encLen;
+            for (int k = 0; match && k < f->encLen; k++)
+                match = s[k] == f->enc[k];
+            if (!match) {
+                if (f->flags & ETLV_FIELD_OPTIONAL)
+                    continue;
+                return s < END ? ETLV_ERR_INVAL : ETLV_ERR_NOENT;
+            }
+
+            v = s + f->encLen;
+            err = decode_length(&len, &v, END-v);
+            if (err < 0)
+                return err;
+            err = resolve_length(f->tag, &len, v, END);
+            if (err < 0)
+                return err;
+            if (len > (uint32_t)(END-v))
+                return ETLV_ERR_MSGSIZE;
+            s = v + len + err;
+        }
+
+        uint8_t* m = out + f->offset;
+        ETLVToken* t;
+        uint32_t x;
+        switch (f->kind) {
+        case ETLV_FIELD_TOKEN:
+            t = (ETLVToken*) m;
+            t->tag = f->tag;
+            t->len = len;
+            t->val = v;
+            break;
+
+        case ETLV_FIELD_UINT:
+            // Up to 4 bytes, after a leading zero byte
+            if (len > 5 || (len == 5 && v[0]))
+                return ETLV_ERR_OVERFLOW;
+            x = 0;
+            for (uint32_t k = 0; k < len; k++)
+                x = (x << 8) | v[k];
+            *(uint32_t*) m = x;
+            break;
+
+        case ETLV_FIELD_NESTED:
+            err = schema_decode(f->sub, m, v, v + len);
+            if (err < 0)
+                return err;
+            break;
+
+        default:
+            return ETLV_ERR_BADARG;
+        }
+    }
+
+    // Objects left over are not in the schema
+    if (s < END)
+        return ETLV_ERR_INVAL;
+
+    return s-BEGIN;
+}
+
+ETLV_API int etlv_schema_decode(const ETLVSchema* sch, void* out,
+                                const void* src, int srcLen)
+{
+    if (!out || !src || srcLen < 0)
+        return ETLV_ERR_BADARG;
+
+    const uint8_t* s = src;
+    return schema_decode(sch, out, s, s + srcLen);
+}
+
+// Compute the encoded size of an unsigned integer value
+static inline int uint_size(uint32_t x)
+{
+    int n = x ? min_size(x) : 1;
+    if ((x >> (8 * (n - 1))) & 0x80) // Keep it positive
+        n++;
+    return n;
+}
+
+// Compute the length of a struct encoded with a schema
+// Returns the length, or negative error
+static int64_t schema_size(const ETLVSchema* sch, const uint8_t* in)
+{
+    if (!sch || !sch->f || sch->nFields < 0)
+        return ETLV_ERR_BADARG;
+
+    int64_t size = 0;
+    int64_t len = 0;
+    for (int i = 0; i < sch->nFields; i++) {
+        const ETLVField* f = &sch->f[i];
+        const uint8_t* m = in + f->offset;
+        switch (f->kind) {
+        case ETLV_FIELD_TOKEN:
+            if (f->flags & ETLV_FIELD_OPTIONAL && !((const ETLVToken*) m)->val)
+                continue;
+            len = ((const ETLVToken*) m)->len;
+            break;
+        case ETLV_FIELD_UINT:
+            len = uint_size(*(const uint32_t*) m);
+            break;
+        case ETLV_FIELD_NESTED:
+            len = schema_size(f->sub, m);
+            if (len < 0)
+                return len;
+            break;
+        default:
+            return ETLV_ERR_BADARG;
+        }
+
+        size += f->encLen + length_size(len) + len;
+        if (size > INT32_MAX)
+            return ETLV_ERR_OVERFLOW;
+    }
+    return size;
+}
+
+// Encode a struct with a schema, whose size was already checked. The fields
+// are written backwards from the end of their space, so the length of a
+// nested value is known by the time its header is written, and no level is
+// sized more than once.
+// Modifies end to point to the first byte written
+static void schema_encode(const ETLVSchema* sch, const uint8_t* in,
+                          uint8_t** end)
+{
+    uint8_t* d = *end;
+    uint32_t len;
+    for (int i = sch->nFields - 1; i >= 0; i--) {
+        const ETLVField* f = &sch->f[i];
+        const uint8_t* m = in + f->offset;
+        const ETLVToken* t = (const ETLVToken*) m;
+        if (f->kind == ETLV_FIELD_TOKEN && f->flags & ETLV_FIELD_OPTIONAL &&
+            !t->val)
+            continue;
+
+        // Write the value, then the length and the encoded tag before it
+        uint8_t* const VAL_END = d;
+        switch (f->kind) {
+        case ETLV_FIELD_TOKEN:
+            len = t->len;
+            d -= len;
+            copy_bytes(d, t->val, len);
+            break;
+        case ETLV_FIELD_UINT:
+            len = uint_size(*(const uint32_t*) m);
+            d -= len;
+            for (uint32_t k = 0, n = len - 1; k < len; k++, n--)
+                d[k] = n < 4 ? (*(const uint32_t*) m >> (8 * n)) & 0xFF : 0;
+            break;
+        default: // Nested
+            schema_encode(f->sub, m, &d);
+            len = VAL_END - d;
+            break;
+        }
+        d -= length_size(len);
+        uint8_t* h = d;
+        encode_length(&h, 16, len);
+        d -= f->encLen;
+        for (int k = 0; k < f->encLen; k++)
+            d[k] = f->enc[k];
+    }
+    *end = d;
+}
+
+ETLV_API int etlv_schema_encode(void* dest, int* len, const ETLVSchema* sch,
+                                const void* in)
+{
+    if (!dest || !len || *len < 0 || !in)
+        return ETLV_ERR_BADARG;
+
+    // Check all sizes first, so encoding cannot fail on the way
+    int64_t size = schema_size(sch, in);
+    if (size < 0)
+        return size;
+    if (size > *len)
+        return ETLV_ERR_NOMEM;
+
+    uint8_t* d = (uint8_t*) dest + size;
+    schema_encode(sch, in, &d);
+
+    // Return total serialized length
+    return *len = size;
+}
+
+#ifdef ETLV_STATS
+ETLV_API void etlv_stats_get(ETLVStats* st)
+{
+    if (st)
+        *st = stats;
+}
+
+ETLV_API void etlv_stats_reset(void)
+{
+    const ETLVStats ZERO = {0};
+    stats = ZERO;
+}
+
+ETLV_API void etlv_trace_set(ETLVTraceCb cb, void* ctx)
+{
+    traceCb = cb;
+    traceCtx = ctx;
+}
+#endif
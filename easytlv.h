@@ -12,8 +12,8 @@
  * more information about this standard, see the ISO8825-1 Basic Encoding
  * Rules: https://www.itu.int/ITU-T/studygroups/com17/languages/X.690-0207.pdf
  * 
- * Note: This library does not implement indefinite length TLV objects, as
- * described in section 8.1.3
+ * Indefinite length TLV objects, as described in section 8.1.3, are decoded
+ * with the length of their contents. Serializing always uses definite lengths.
  */
 
 /**
@@ -43,12 +43,26 @@
 #ifndef __EASYTLV_H__
 #define __EASYTLV_H__
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define EASYTLV_VER_MAJOR 1
 #define EASYTLV_VER_MINOR 0
 #define EASYTLV_VER_PATCH 0
 
+// Header-only mode: define EASYTLV_IMPLEMENTATION before including this
+// header, and the implementation is compiled into the including file. Every
+// function is then static inline, so each file gets a private copy which the
+// compiler may inline into its callers. Define ETLV_API as empty to compile a
+// single shared copy instead, in one file only.
+#ifndef ETLV_API
+    #ifdef EASYTLV_IMPLEMENTATION
+        #define ETLV_API static inline
+    #else
+        #define ETLV_API
+    #endif
+#endif
+
 
 typedef enum {
     ETLV_ERR_UNKNOWN    = -128, // Unknown failure
@@ -62,6 +76,16 @@ typedef enum {
     ETLV_ERR_OK         = 0,    // No error
 } ETLVError;
 
+// Flags for etlv_validate
+typedef enum {
+    ETLV_VALIDATE_MINIMAL = 0x01, // Require the shortest tag and length encodings
+} ETLVValidateFlags;
+
+// Flags of an ETLVNode
+typedef enum {
+    ETLV_NODE_INDEFINITE = 0x01, // Object was encoded with an indefinite length
+} ETLVNodeFlags;
+
 // A token describes a TLV object. Tag field does not need to occupy the
 // entire 32b width. For example, a tag of 0x14 will properly be encoded as a
 // single byte field.
@@ -72,6 +96,242 @@ typedef struct {
 } ETLVToken;
 
 
+// A caller supplied allocator, for the functions which allocate their storage
+typedef struct {
+    void*   (*alloc)(void* ctx, size_t size);
+    void    (*free)(void* ctx, void* p);
+    void*   ctx;
+} ETLVAllocator;
+
+// A bump pointer arena, see `etlv_arena_init`
+typedef struct {
+    uint8_t*    buf;
+    size_t      cap;
+    size_t      used;
+} ETLVArena;
+
+// A token with a 64 bit length, for the _ex API family
+typedef struct {
+    uint32_t    tag;
+    uint64_t    len;
+    const void* val;
+} ETLVTokenEx;
+
+// A memory mapped file of TLV data. Treat as opaque, use `etlv_file_map` or
+// `etlv_file_open`.
+typedef struct {
+    const uint8_t*  base;
+    size_t          size;
+    int             fd;     // Descriptor of a file opened by us, or -1
+} ETLVFile;
+
+// Tag of the trailer which ends each record of an append-only TLV log, a
+// private class primitive object
+#define ETLV_TRAILER_TAG 0xDF7F
+
+// Size of an encoded trailer: its tag, a length of 4 and the record length
+#define ETLV_TRAILER_SIZE 7
+
+// Cursor walking the records of a TLV log backwards. Treat as opaque, use
+// `etlv_log_iter_init`.
+typedef struct {
+    const uint8_t*  src;
+    size_t          pos;    // End of the records not visited yet
+} ETLVLogIter;
+
+// A scatter/gather buffer, with the same members as POSIX `struct iovec`
+typedef struct {
+    const void* base;
+    size_t      len;
+} ETLVIovec;
+
+// One record of a batch parse
+typedef struct {
+    const void* src;    // Input source pointer to TLV data
+    int         srcLen; // Input length of source data to parse
+    int         first;  // Output index of the record's first token
+    int         nTok;   // Output number of tokens parsed
+    int         result; // Output length of the parsed data, or negative error
+} ETLVRecord;
+
+// A job run by a thread pool, `i` is the index of the job
+typedef void (*ETLVJob)(void* arg, int i);
+
+// A caller supplied thread pool. `run` must call `job(arg, i)` for every i in
+// [0, n), possibly concurrently, and return once all of them have completed.
+// Work is split into at most `nJobs` jobs.
+typedef struct {
+    void (*run)(void* ctx, ETLVJob job, void* arg, int n);
+    void*       ctx;
+    int         nJobs;
+} ETLVPool;
+
+// A compact token of 12 bytes, which stores the value as a byte offset from
+// the start of the parsed data instead of a pointer
+typedef struct {
+    uint32_t    tag;
+    uint32_t    len;
+    uint32_t    off;
+} ETLVCompactToken;
+
+// A tag which has already been validated and encoded, see `etlv_encode_tag`
+typedef struct {
+    uint8_t     b[4];
+    uint8_t     n;
+} ETLVEncodedTag;
+
+// A token carrying a pre-encoded tag
+typedef struct {
+    ETLVEncodedTag  tag;
+    uint32_t        len;
+    const void*     val;
+} ETLVEncodedToken;
+
+// Kinds of schema fields
+typedef enum {
+    ETLV_FIELD_TOKEN = 0,   // Member is an ETLVToken pointing to the value
+    ETLV_FIELD_UINT,        // Member is a uint32_t, from an unsigned integer
+    ETLV_FIELD_NESTED,      // Member is a struct, decoded with its own schema
+} ETLVFieldKind;
+
+// Flags of schema fields
+typedef enum {
+    ETLV_FIELD_OPTIONAL = 0x01, // Field may be missing
+} ETLVFieldFlags;
+
+struct ETLVSchema;
+
+// A field of a schema, maps one TLV object to one member of a struct. Use
+// `ETLV_FIELD` to build fields, which encodes the tag at compile time.
+typedef struct {
+    uint32_t                    tag;
+    uint8_t                     enc[4];     // Encoded tag bytes
+    uint8_t                     encLen;
+    uint8_t                     kind;       // ETLVFieldKind
+    uint8_t                     flags;      // ETLVFieldFlags
+    size_t                      offset;     // Offset of the member
+    const struct ETLVSchema*    sub;        // Schema of an ETLV_FIELD_NESTED
+} ETLVField;
+
+// A schema lists the fields of a message, in the order they are encoded
+typedef struct ETLVSchema {
+    const ETLVField*    f;
+    int                 nFields;
+} ETLVSchema;
+
+// Number of bytes of an encoded tag
+#define ETLV_TAG_LEN(tag) \
+    ((tag) > 0xFFFFFF ? 4 : (tag) > 0xFFFF ? 3 : (tag) > 0xFF ? 2 : 1)
+
+// Byte i of an encoded tag, or 0 past its end
+#define ETLV_TAG_BYTE(tag, i) ((uint8_t) ((i) < ETLV_TAG_LEN(tag) ? \
+    (tag) >> (8 * ((ETLV_TAG_LEN(tag) - 1 - (i)) & 3)) : 0))
+
+// Field of a schema for `member` of the struct `type`. The tag must be valid,
+// and `sub` is the schema of an ETLV_FIELD_NESTED member, or NULL.
+#define ETLV_FIELD(type, member, tag, kind, flags, sub) \
+    {(tag), {ETLV_TAG_BYTE(tag, 0), ETLV_TAG_BYTE(tag, 1), \
+             ETLV_TAG_BYTE(tag, 2), ETLV_TAG_BYTE(tag, 3)}, \
+     ETLV_TAG_LEN(tag), (kind), (flags), offsetof(type, member), (sub)}
+
+// Schema from a static array of fields
+#define ETLV_SCHEMA(fields) {(fields), sizeof(fields) / sizeof((fields)[0])}
+
+// A node describes a TLV object inside of a nested TLV tree. Nodes are stored
+// in pre-order, so the children of a node directly follow it. `parent` and
+// `next` (next sibling) are indices into the same node array, or -1 if there
+// is no such node. Top level objects have a depth of 0.
+typedef struct {
+    ETLVToken   tok;
+    int         depth;
+    int         parent;
+    int         next;
+    int         flags;  // ETLVNodeFlags
+} ETLVNode;
+
+// An index entry records where one TLV object sits in the indexed data
+typedef struct {
+    uint32_t    tag;
+    uint32_t    len;
+    int         offset;     // Byte offset of the object
+    int         valOffset;  // Byte offset of the object's value
+} ETLVIndexEntry;
+
+// An index over one level of TLV data, for repeated tag lookups. Entries are
+// kept sorted by tag, then by offset, in caller supplied storage.
+typedef struct {
+    const uint8_t*  src;
+    ETLVIndexEntry* e;
+    int             n;
+} ETLVIndex;
+
+// Cursor over one level of TLV objects, decoding one object per step. Treat
+// as opaque, use `etlv_iter_init`.
+typedef struct {
+    const uint8_t*  base;   // Start of the data, which offsets are counted from
+    const uint8_t*  pos;    // Next object to decode
+    const uint8_t*  end;    // End of the level
+    ETLVToken       cur;    // Object last returned by `etlv_iter_next`
+    int             err;
+} ETLVIter;
+
+// Events reported by a streaming decoder
+typedef enum {
+    ETLV_STREAM_TOKEN,  // Complete object, with its value inside the chunk
+    ETLV_STREAM_BEGIN,  // Header of an object whose value spans chunks
+    ETLV_STREAM_DATA,   // Next fragment of the value begun by ETLV_STREAM_BEGIN
+    ETLV_STREAM_END,    // End of the value begun by ETLV_STREAM_BEGIN
+} ETLVStreamEvent;
+
+// Streaming decoder callback. For ETLV_STREAM_BEGIN and ETLV_STREAM_END the
+// token holds the tag and total length with a NULL value. For
+// ETLV_STREAM_DATA it holds the tag and the fragment's pointer and length.
+// An object of indefinite length begins with a length of 0, its contents are
+// reported as objects of their own, and it ends with the length of its
+// contents. Return a negative error to abort decoding.
+typedef int (*ETLVStreamCb)(void* ctx, ETLVStreamEvent ev, const ETLVToken* t);
+
+// Maximum nesting of indefinite length objects in an ETLVStream
+#ifndef ETLV_STREAM_MAX_DEPTH
+    #define ETLV_STREAM_MAX_DEPTH 16
+#endif
+
+// State of a streaming decoder. Treat as opaque, use `etlv_stream_init`.
+typedef struct {
+    ETLVStreamCb    cb;
+    void*           ctx;
+    uint32_t        tag;
+    uint32_t        len;
+    uint32_t        remain;
+    int             state;
+    int             err;
+    uint64_t        pos;                            // Bytes fed so far
+    int             depth;
+    uint32_t        open[ETLV_STREAM_MAX_DEPTH];    // Tag of each open object
+    uint64_t        start[ETLV_STREAM_MAX_DEPTH];   // Offset of each value
+} ETLVStream;
+
+// Maximum nesting of constructed objects in an ETLVWriter
+#ifndef ETLV_WRITER_MAX_DEPTH
+    #define ETLV_WRITER_MAX_DEPTH 16
+#endif
+
+// Maximum nesting of the object patched by `etlv_patch`
+#ifndef ETLV_PATCH_MAX_DEPTH
+    #define ETLV_PATCH_MAX_DEPTH 16
+#endif
+
+// State of a TLV writer. Treat as opaque, use `etlv_writer_init`.
+typedef struct {
+    uint8_t*    buf;
+    int         cap;
+    int         pos;
+    int         depth;
+    int         err;
+    int         open[ETLV_WRITER_MAX_DEPTH];    // Offset of each open length
+    uint8_t     width[ETLV_WRITER_MAX_DEPTH];   // Bytes reserved for each length
+} ETLVWriter;
+
 /**
  * Parse TLV encoded data for TLV objects
  *
@@ -82,18 +342,115 @@ typedef struct {
  * In the event of an ETLV_ERR_NOMEM error, the output of `nTok` will still
  * represent the total number of tokens found in the byte array.
  *
- * [output] t       Array of tokens to be populated with parsed data
+ * If `t` is NULL, no tokens are stored and the input value of `nTok` is
+ * ignored. This counting mode can be used to size a token array exactly
+ * before parsing the same data again.
+ *
+ * The token of an object with an indefinite length holds the length of its
+ * contents, which are followed by the two end-of-contents octets.
+ *
+ * [output] t       Array of tokens to be populated with parsed data (or NULL)
  * [in/out] nTok    Input size of the array / Output number of tokens parsed
  * [input]  src     Source pointer to TLV data
  * [input]  srcLen  Length source data to parse
  *
  * Returns number of tokens parsed, or negative error
  */
-int etlv_parse(ETLVToken* t, int* nTok, const void* src, int srcLen);
+ETLV_API int etlv_parse(ETLVToken* t, int* nTok, const void* src, int srcLen);
+
+/**
+ * Parse many independent TLV messages at once
+ *
+ * Each record is parsed like `etlv_parse`, into consecutive slices of one
+ * shared token arena. The result, first token index and token count of each
+ * record are written into the record. A record which does not fit into the
+ * rest of the arena reports ETLV_ERR_NOMEM and the number of tokens it needs,
+ * and uses no arena space. Records with other errors report 0 tokens.
+ *
+ * With a thread pool, the records are split across the pool's jobs. Tokens
+ * are then counted in a first parallel pass, to find each record's slice.
+ *
+ * [in/out] r       Array of records to be parsed
+ * [input]  nRec    Number of records to be parsed
+ * [output] t       Token arena to be populated with parsed data
+ * [input]  nTok    Size of the token arena
+ * [input]  pool    Thread pool to be used, or NULL to parse on this thread
+ *
+ * Returns the number of arena tokens used, or negative error
+ */
+ETLV_API int etlv_parse_batch(ETLVRecord* r, int nRec, ETLVToken* t, int nTok,
+                              const ETLVPool* pool);
+
+/**
+ * Parse nested TLV encoded data into a flat tree of TLV objects
+ *
+ * Unlike `etlv_parse`, this parser descends into the value of every object
+ * with the constructed bit (0x20) set in its first tag octet, and decodes the
+ * whole nesting in one pass. A constructed value that is not valid TLV data
+ * is reported as an error.
+ *
+ * Objects of indefinite length are flagged with ETLV_NODE_INDEFINITE and hold
+ * the length of their contents. Their end-of-contents produce no nodes.
+ *
+ * [output] nodes   Array of nodes to be populated with parsed data
+ * [in/out] nNodes  Input size of the array / Output number of nodes parsed
+ * [input]  src     Source pointer to TLV data
+ * [input]  srcLen  Length source data to parse
+ *
+ * Returns the length of the parsed data, or negative error
+ */
+ETLV_API int etlv_parse_tree(ETLVNode* nodes, int* nNodes, const void* src,
+                             int srcLen);
+
+/**
+ * Parse nested TLV encoded data into a flat tree of TLV objects, in parallel
+ *
+ * Produces the same nodes as `etlv_parse_tree`. The top level objects are
+ * first split into one range per pool job, by a quick walk over their headers.
+ * The nodes of every range are then counted and parsed in parallel, each range
+ * into its own slice of the node array. On invalid data, or a node array that
+ * is too small, the data is parsed again on this thread, to report the same
+ * error `etlv_parse_tree` does.
+ *
+ * [output] nodes   Array of nodes to be populated with parsed data
+ * [in/out] nNodes  Input size of the array / Output number of nodes parsed
+ * [input]  src     Source pointer to TLV data
+ * [input]  srcLen  Length source data to parse
+ * [input]  pool    Thread pool to be used, split into at most 64 jobs
+ *
+ * Returns the length of the parsed data, or negative error
+ */
+ETLV_API int etlv_parse_tree_parallel(ETLVNode* nodes, int* nNodes,
+                                      const void* src, int srcLen,
+                                      const ETLVPool* pool);
+
+/**
+ * Validate nested TLV encoded data, without producing any tokens
+ *
+ * The data is checked the same way as `etlv_parse_tree` would decode it: every
+ * object with the constructed bit set is checked again as TLV data, and no
+ * value may run past the end of its parent. Nothing is allocated.
+ *
+ * With ETLV_VALIDATE_MINIMAL, tags and lengths must also use their shortest
+ * encoding, and lengths must be definite, as required by DER.
+ *
+ * [output] errOff      Byte offset of the first invalid object (or NULL)
+ * [input]  src         Source pointer to TLV data
+ * [input]  srcLen      Length source data to validate
+ * [input]  maxDepth    Deepest nesting allowed, 0 allows only top level objects
+ * [input]  flags       ETLVValidateFlags
+ *
+ * Returns the number of objects found at all levels, or negative error
+ */
+ETLV_API int etlv_validate(int* errOff, const void* src, int srcLen,
+                           int maxDepth, int flags);
 
 /**
  * Serialize an array of TLV objects
  *
+ * An empty value is serialized with a single 0x00 length octet, and its token
+ * may have a NULL value pointer.
+ *
  * [output] dest    Destination to receive serialized data
  * [in/out] len     Input size of the destination / Output serialized length
  * [input]  t       Array of tokens to be serialized
@@ -101,7 +458,92 @@ int etlv_parse(ETLVToken* t, int* nTok, const void* src, int srcLen);
  *
  * Returns the length of the serialized data, or negative error
  */
-int etlv_serialize(void* dest, int* len, const ETLVToken* t, int nTok);
+ETLV_API int etlv_serialize(void* dest, int* len, const ETLVToken* t, int nTok);
+
+/**
+ * Serialize a tree of nested TLV objects
+ *
+ * The nodes must be in pre-order with valid parent indices, as produced by
+ * `etlv_parse_tree`. Nodes without children are serialized from their value.
+ * The length of every node with children is computed from its children, and
+ * written back into the node.
+ *
+ * All sizes are computed first, so every node's final offset is known. With
+ * a thread pool, the nodes are then split into ranges which are written
+ * straight into their place in the destination, in parallel.
+ *
+ * [output] dest    Destination to receive serialized data
+ * [in/out] len     Input size of the destination / Output serialized length
+ * [in/out] nodes   Array of nodes to be serialized
+ * [input]  nNodes  Number of nodes to be serialized
+ * [input]  pool    Thread pool to be used (split into at most 64 jobs), or NULL
+ *
+ * Returns the length of the serialized data, or negative error
+ */
+ETLV_API int etlv_serialize_tree(void* dest, int* len, ETLVNode* nodes,
+                                 int nNodes, const ETLVPool* pool);
+
+/**
+ * Replace the value of one node of a parsed tree, in place
+ *
+ * The nodes must have been produced by `etlv_parse_tree` from the start of
+ * `buf`, and the patched node must not have children. Only the length fields
+ * of the node and its ancestors are rewritten, and the bytes after the value
+ * are moved once. When the value keeps its length, only the value is copied.
+ * The nodes are updated to point into the patched data.
+ *
+ * An object of tag 0 directly inside an object of indefinite length cannot be
+ * emptied, as it would read as the end-of-contents.
+ *
+ * Lengths are written in their shortest encoding, except that a longer than
+ * necessary length field keeps its width when its length grows.
+ *
+ * [in/out] buf     Buffer holding the parsed data
+ * [in/out] len     Input length of the data / Output patched length
+ * [input]  cap     Size of the buffer, at least the length of the data
+ * [in/out] nodes   Nodes of the parsed data
+ * [input]  nNodes  Number of nodes
+ * [input]  idx     Index of the node to patch
+ * [input]  val     New value, which must not lie inside of the buffer
+ * [input]  valLen  Length of the new value
+ *
+ * Returns the length of the patched data, or negative error
+ */
+ETLV_API int etlv_patch(void* buf, int* len, int cap, ETLVNode* nodes,
+                        int nNodes, int idx, const void* val, int valLen);
+
+/**
+ * Serialize an array of TLV objects into a scatter/gather list
+ *
+ * Only the tag and length fields are written, into the header buffer. The
+ * output buffer list interleaves those headers with the tokens' own value
+ * buffers, which are never copied. Suited for `writev` or `sendmsg`. At most
+ * 2 * `nTok` buffers are needed.
+ *
+ * [output] iov     Array of buffers to be populated
+ * [in/out] nIov    Input size of the buffer array / Output number of buffers
+ * [output] hdr     Buffer to receive tag and length fields
+ * [in/out] hdrLen  Input size of the header buffer / Output length used
+ * [input]  t       Array of tokens to be serialized
+ * [input]  nTok    Number of tokens to be serialized
+ *
+ * Returns the total length of the serialized data, or negative error
+ */
+ETLV_API int etlv_serialize_iov(ETLVIovec* iov, int* nIov, void* hdr,
+                                int* hdrLen, const ETLVToken* t, int nTok);
+
+/**
+ * Compute the exact serialized size of an array of TLV objects
+ *
+ * Nothing is written. The result is the buffer size `etlv_serialize` needs
+ * for the same tokens, so a destination can be allocated exactly once.
+ *
+ * [input]  t       Array of tokens to be measured
+ * [input]  nTok    Number of tokens to be measured
+ *
+ * Returns the length the serialized data would have, or negative error
+ */
+ETLV_API int etlv_serialized_size(const ETLVToken* t, int nTok);
 
 /**
  * Find the first occurance of a tag in a TLV encoded payload
@@ -112,6 +554,702 @@ int etlv_serialize(void* dest, int* len, const ETLVToken* t, int nTok);
  *
  * Returns the byte offset of the found token, or negative error
  */
-int etlv_find(ETLVToken* t, uint32_t tag, const void* src, int srcLen);
+ETLV_API int etlv_find(ETLVToken* t, uint32_t tag, const void* src, int srcLen);
+
+/**
+ * Find the first occurance of each of a set of tags in a TLV encoded payload
+ *
+ * The payload is scanned once, and the scan stops as soon as every tag has
+ * been found. Tokens for tags which are not found have a NULL value pointer
+ * and a length of 0.
+ *
+ * [output] t       Array of `nTags` tokens, one for each requested tag
+ * [input]  tags    Array of tags to search for
+ * [input]  nTags   Number of tags to search for
+ * [input]  src     Source pointer to TLV data
+ * [input]  srcLen  Length source data to search
+ *
+ * Returns the number of tags found, or negative error
+ */
+ETLV_API int etlv_find_many(ETLVToken* t, const uint32_t* tags, int nTags,
+                            const void* src, int srcLen);
+
+/**
+ * Build an index over TLV encoded data, for repeated tag lookups
+ *
+ * Like `etlv_find`, only one level of TLV objects is indexed. The index points
+ * into `src`, which must stay valid for as long as the index is used.
+ *
+ * [output] idx         Index to be built
+ * [output] e           Array of entries to be used as index storage
+ * [input]  nEntries    Size of the entry array
+ * [input]  src         Source pointer to TLV data
+ * [input]  srcLen      Length source data to index
+ *
+ * Returns the number of indexed objects, or negative error
+ */
+ETLV_API int etlv_index_build(ETLVIndex* idx, ETLVIndexEntry* e, int nEntries,
+                              const void* src, int srcLen);
+
+/**
+ * Find the nth occurance of a tag in an index
+ *
+ * [output] t       Token information for the found tag (if found)
+ * [input]  idx     Index to search
+ * [input]  tag     Tag to search for
+ * [input]  nth     Occurance to find, counted from 0
+ *
+ * Returns the byte offset of the found token, or negative error
+ */
+ETLV_API int etlv_index_find(ETLVToken* t, const ETLVIndex* idx, uint32_t tag,
+                             int nth);
+
+/**
+ * Initialize a cursor on the top level of TLV encoded data
+ *
+ * A cursor decodes one object per step, without any token array, and nothing
+ * past the last step is decoded.
+ *
+ * [output] it      Cursor to be initialized
+ * [input]  src     Source pointer to TLV data
+ * [input]  srcLen  Length source data to iterate over
+ */
+ETLV_API void etlv_iter_init(ETLVIter* it, const void* src, int srcLen);
+
+/**
+ * Decode the next object of a cursor's level
+ *
+ * The cursor moves past the object's value, onto its next sibling. Errors are
+ * sticky, every later step returns the same error.
+ *
+ * [in/out] it      Cursor
+ * [output] t       Token of the object
+ *
+ * Returns the byte offset of the object from the start of the data given to
+ * `etlv_iter_init`, ETLV_ERR_NOENT at the end of the level, or negative error
+ */
+ETLV_API int etlv_iter_next(ETLVIter* it, ETLVToken* t);
+
+/**
+ * Initialize a cursor on the value of the constructed object last returned
+ * by `etlv_iter_next`
+ *
+ * The parent cursor is left on the object's next sibling, so iterating can
+ * resume there once the child is done. The child may be the parent cursor
+ * itself, to descend without coming back.
+ *
+ * [input]  it      Parent cursor
+ * [output] child   Cursor to be initialized
+ *
+ * Returns ETLV_ERR_OK, or negative error
+ */
+ETLV_API int etlv_iter_enter(const ETLVIter* it, ETLVIter* child);
+
+/**
+ * Skip objects of a cursor's level, without outputting their tokens
+ *
+ * [in/out] it      Cursor
+ * [input]  n       Number of objects to skip
+ *
+ * Returns the number of objects skipped, which is less than `n` at the end of
+ * the level, or negative error
+ */
+ETLV_API int etlv_iter_skip(ETLVIter* it, int n);
+
+/**
+ * Initialize a streaming decoder
+ *
+ * A streaming decoder parses one level of TLV objects, like `etlv_parse`, from
+ * data delivered in arbitrary chunks. Tags and lengths may span chunks.
+ *
+ * [output] st      Stream state to be initialized
+ * [input]  cb      Callback receiving decoded objects
+ * [input]  ctx     User context passed to the callback
+ */
+ETLV_API void etlv_stream_init(ETLVStream* st, ETLVStreamCb cb, void* ctx);
+
+/**
+ * Feed the next chunk of TLV encoded data to a streaming decoder
+ *
+ * An object whose value lies completely inside the chunk is reported as a
+ * single ETLV_STREAM_TOKEN pointing into the chunk. Other values are reported
+ * as ETLV_STREAM_BEGIN, one ETLV_STREAM_DATA per chunk, then ETLV_STREAM_END.
+ * Pointers passed to the callback are only valid during the callback.
+ *
+ * After an error the stream cannot continue, and every further call returns
+ * the same error.
+ *
+ * [in/out] st      Stream state
+ * [input]  src     Source pointer to the chunk
+ * [input]  srcLen  Length of the chunk
+ *
+ * Returns the number of bytes consumed, or negative error
+ */
+ETLV_API int etlv_stream_feed(ETLVStream* st, const void* src, int srcLen);
+
+/**
+ * Check that a streaming decoder stopped on an object boundary
+ *
+ * [input]  st      Stream state
+ *
+ * Returns ETLV_ERR_OK, or negative error if the stream ended inside an object
+ */
+ETLV_API int etlv_stream_finish(const ETLVStream* st);
+
+/**
+ * Initialize a writer, for serializing nested TLV objects in place
+ *
+ * A writer serializes objects directly into the destination buffer. The
+ * length of a constructed object is written when the object is ended, so
+ * children never need to be serialized into a temporary buffer.
+ *
+ * Errors are sticky: after a failure every further call returns the same
+ * error, so a sequence of calls may be checked once with `etlv_writer_finish`.
+ *
+ * [output] w       Writer to be initialized
+ * [output] dest    Destination to receive serialized data
+ * [input]  destLen Size of the destination
+ */
+ETLV_API void etlv_writer_init(ETLVWriter* w, void* dest, int destLen);
+
+/**
+ * Serialize one TLV object with a writer
+ *
+ * [in/out] w       Writer
+ * [input]  t       Token to be serialized
+ *
+ * Returns the length of the serialized data so far, or negative error
+ */
+ETLV_API int etlv_writer_add(ETLVWriter* w, const ETLVToken* t);
+
+/**
+ * Begin a constructed TLV object with a writer
+ *
+ * Every object written until the matching `etlv_writer_end` becomes part of
+ * this object's value. Room is reserved for a length of `sizeHint` bytes. If
+ * the final length needs a different number of bytes, the value is moved once
+ * when the object is ended.
+ *
+ * [in/out] w           Writer
+ * [input]  tag         Tag of the constructed object
+ * [input]  sizeHint    Expected length of the value, or 0 if unknown
+ *
+ * Returns the length of the serialized data so far, or negative error
+ */
+ETLV_API int etlv_writer_begin_constructed(ETLVWriter* w, uint32_t tag,
+                                           uint32_t sizeHint);
+
+/**
+ * End the innermost constructed TLV object of a writer
+ *
+ * [in/out] w       Writer
+ *
+ * Returns the length of the serialized data so far, or negative error
+ */
+ETLV_API int etlv_writer_end(ETLVWriter* w);
+
+/**
+ * Check a writer for errors and get the serialized length
+ *
+ * [input]  w       Writer
+ *
+ * Returns the length of the serialized data, or negative error
+ */
+ETLV_API int etlv_writer_finish(const ETLVWriter* w);
+
+/**
+ * The _ex API family
+ *
+ * These functions behave like their counterparts without the suffix, but use
+ * `size_t` for buffer sizes, and 64 bit lengths of up to 8 length octets. This
+ * allows them to operate on data larger than 2 GiB, such as memory mapped
+ * files.
+ */
+
+/**
+ * Parse TLV encoded data for TLV objects, see `etlv_parse`
+ *
+ * [output] t       Array of tokens to be populated with parsed data (or NULL)
+ * [in/out] nTok    Input size of the array / Output number of tokens parsed
+ * [input]  src     Source pointer to TLV data
+ * [input]  srcLen  Length source data to parse
+ *
+ * Returns length of the parsed data, or negative error
+ */
+ETLV_API int64_t etlv_parse_ex(ETLVTokenEx* t, size_t* nTok, const void* src,
+                               size_t srcLen);
+
+/**
+ * Serialize an array of TLV objects, see `etlv_serialize`
+ *
+ * [output] dest    Destination to receive serialized data
+ * [in/out] len     Input size of the destination / Output serialized length
+ * [input]  t       Array of tokens to be serialized
+ * [input]  nTok    Number of tokens to be serialized
+ *
+ * Returns the length of the serialized data, or negative error
+ */
+ETLV_API int64_t etlv_serialize_ex(void* dest, size_t* len,
+                                   const ETLVTokenEx* t, size_t nTok);
+
+/**
+ * Find the first occurance of a tag in a TLV encoded payload, see `etlv_find`
+ *
+ * An object running past the end of the data before the tag is found is an
+ * ETLV_ERR_MSGSIZE error, so truncated data is not reported as ETLV_ERR_NOENT.
+ *
+ * [output] t       Token information for the found tag (if found)
+ * [input]  tag     Tag to search for
+ * [input]  src     Source pointer to TLV data
+ * [input]  srcLen  Length source data to search
+ *
+ * Returns the byte offset of the found token, or negative error
+ */
+ETLV_API int64_t etlv_find_ex(ETLVTokenEx* t, uint32_t tag, const void* src,
+                              size_t srcLen);
+
+/**
+ * Memory mapped TLV files
+ *
+ * Nothing is decoded up front. Objects are decoded only when they are parsed
+ * or searched for, one level at a time, so pages of the file which hold no
+ * visited headers or values are never read. The returned tokens point into
+ * the mapping.
+ */
+
+/**
+ * Use a caller provided mapping (or any buffer) as a TLV file
+ *
+ * [output] f       File to be initialized
+ * [input]  base    Start of the mapping
+ * [input]  size    Size of the mapping
+ *
+ * Returns ETLV_ERR_OK, or negative error
+ */
+ETLV_API int etlv_file_map(ETLVFile* f, const void* base, size_t size);
+
+#ifdef ETLV_USE_MMAP
+/**
+ * Memory map a TLV file, read only (requires POSIX, build with ETLV_USE_MMAP)
+ *
+ * [output] f       File to be initialized
+ * [input]  path    Path of the file
+ *
+ * Returns ETLV_ERR_OK, or negative error
+ */
+ETLV_API int etlv_file_open(ETLVFile* f, const char* path);
+
+/**
+ * Unmap a file opened with `etlv_file_open`
+ *
+ * [in/out] f       File to be closed
+ */
+ETLV_API void etlv_file_close(ETLVFile* f);
+#endif
+
+/**
+ * Parse one level of TLV objects of a file, see `etlv_parse_ex`
+ *
+ * [output] t       Array of tokens to be populated with parsed data (or NULL)
+ * [in/out] nTok    Input size of the array / Output number of tokens parsed
+ * [input]  f       File to parse
+ * [input]  parent  Object whose value is parsed, or NULL for the top level
+ *
+ * Returns length of the parsed data, or negative error
+ */
+ETLV_API int64_t etlv_file_parse(ETLVTokenEx* t, size_t* nTok,
+                                 const ETLVFile* f, const ETLVTokenEx* parent);
+
+/**
+ * Find the first occurance of a tag on one level of a file, see `etlv_find_ex`
+ *
+ * [output] t       Token information for the found tag (if found)
+ * [input]  tag     Tag to search for
+ * [input]  f       File to search
+ * [input]  parent  Object whose value is searched, or NULL for the top level
+ *
+ * Returns the byte offset of the found token from the start of the file, or
+ * negative error
+ */
+ETLV_API int64_t etlv_file_find(ETLVTokenEx* t, uint32_t tag, const ETLVFile* f,
+                                const ETLVTokenEx* parent);
+
+/**
+ * Append-only TLV logs
+ *
+ * TLV data can only be decoded forwards, as a header cannot be told apart
+ * from the value bytes before it. A log can instead end each record with a
+ * trailer: an object with the tag ETLV_TRAILER_TAG and a 4 byte big endian
+ * value holding the length of the record before it. Trailers have a fixed
+ * size, so the newest records are reached from the tail of the log without
+ * decoding anything in front of them.
+ */
+
+/**
+ * Encode the trailer of a log record
+ *
+ * [output] dest    Destination to receive the trailer
+ * [input]  destLen Size of the destination
+ * [input]  recLen  Length of the record, without its trailer
+ *
+ * Returns ETLV_TRAILER_SIZE, or negative error
+ */
+ETLV_API int etlv_trailer_encode(void* dest, size_t destLen, uint32_t recLen);
+
+/**
+ * Initialize a cursor on the last record of a log
+ *
+ * [output] it      Cursor to be initialized
+ * [input]  src     Source pointer to the log
+ * [input]  srcLen  Length of the log
+ */
+ETLV_API void etlv_log_iter_init(ETLVLogIter* it, const void* src,
+                                 size_t srcLen);
+
+/**
+ * Step a log cursor back by one record
+ *
+ * The record is output as a token with the trailer's tag, whose value is the
+ * record's objects. It can be passed as the parent to `etlv_file_parse` and
+ * `etlv_file_find`.
+ *
+ * [in/out] it      Cursor
+ * [output] rec     The record
+ *
+ * Returns the byte offset of the record, ETLV_ERR_NOENT once the start of the
+ * log is reached, or negative error
+ */
+ETLV_API int64_t etlv_log_iter_prev(ETLVLogIter* it, ETLVTokenEx* rec);
+
+/**
+ * Find the last occurance of a tag in a TLV encoded payload
+ *
+ * When the payload ends with a trailer, it is searched as a log, one record
+ * at a time from the newest, and the scan stops in the first record holding
+ * the tag. Otherwise the whole payload is scanned, as one level.
+ *
+ * [output] t       Token information for the found tag (if found)
+ * [input]  tag     Tag to search for
+ * [input]  src     Source pointer to TLV data
+ * [input]  srcLen  Length source data to search
+ *
+ * Returns the byte offset of the found token, or negative error
+ */
+ETLV_API int64_t etlv_find_last_ex(ETLVTokenEx* t, uint32_t tag,
+                                   const void* src, size_t srcLen);
+
+/**
+ * Find the last occurance of a tag in a TLV encoded payload, see
+ * `etlv_find_last_ex`
+ *
+ * [output] t       Token information for the found tag (if found)
+ * [input]  tag     Tag to search for
+ * [input]  src     Source pointer to TLV data
+ * [input]  srcLen  Length source data to search
+ *
+ * Returns the byte offset of the found token, or negative error
+ */
+ETLV_API int etlv_find_last(ETLVToken* t, uint32_t tag, const void* src,
+                            int srcLen);
+
+/**
+ * Find the last occurance of a tag on one level of a file, see
+ * `etlv_find_last_ex`
+ *
+ * [output] t       Token information for the found tag (if found)
+ * [input]  tag     Tag to search for
+ * [input]  f       File to search
+ * [input]  parent  Object whose value is searched, or NULL for the top level
+ *
+ * Returns the byte offset of the found token from the start of the file, or
+ * negative error
+ */
+ETLV_API int64_t etlv_file_find_last(ETLVTokenEx* t, uint32_t tag,
+                                     const ETLVFile* f,
+                                     const ETLVTokenEx* parent);
+
+/**
+ * Compact tokens
+ *
+ * These functions behave like their counterparts using `ETLVToken`, but
+ * produce or consume `ETLVCompactToken`s, which need 12 instead of 16 bytes on
+ * 64 bit targets. Offsets are relative to the start of the parsed data.
+ */
+
+/**
+ * Parse TLV encoded data into compact tokens, see `etlv_parse`
+ *
+ * [output] t       Array of tokens to be populated with parsed data (or NULL)
+ * [in/out] nTok    Input size of the array / Output number of tokens parsed
+ * [input]  src     Source pointer to TLV data
+ * [input]  srcLen  Length source data to parse
+ *
+ * Returns the length of the parsed data, or negative error
+ */
+ETLV_API int etlv_parse_compact(ETLVCompactToken* t, int* nTok, const void* src,
+                                int srcLen);
+
+/**
+ * Find the first occurance of a tag as a compact token, see `etlv_find`
+ *
+ * [output] t       Token information for the found tag (if found)
+ * [input]  tag     Tag to search for
+ * [input]  src     Source pointer to TLV data
+ * [input]  srcLen  Length source data to search
+ *
+ * Returns the byte offset of the found token, or negative error
+ */
+ETLV_API int etlv_find_compact(ETLVCompactToken* t, uint32_t tag,
+                               const void* src, int srcLen);
+
+/**
+ * Serialize an array of compact tokens, see `etlv_serialize`
+ *
+ * [output] dest    Destination to receive serialized data
+ * [in/out] len     Input size of the destination / Output serialized length
+ * [input]  t       Array of tokens to be serialized
+ * [input]  nTok    Number of tokens to be serialized
+ * [input]  base    Data the token offsets are relative to
+ *
+ * Returns the length of the serialized data, or negative error
+ */
+ETLV_API int etlv_serialize_compact(void* dest, int* len,
+                                    const ETLVCompactToken* t, int nTok,
+                                    const void* base);
+
+/**
+ * Encode a tag once, so that it can be serialized repeatedly without
+ * validating and encoding it again
+ *
+ * [output] e       Encoded tag
+ * [input]  tag     Tag to encode
+ *
+ * Returns the number of tag bytes, or negative error
+ */
+ETLV_API int etlv_encode_tag(ETLVEncodedTag* e, uint32_t tag);
+
+/**
+ * Serialize an array of tokens with pre-encoded tags, see `etlv_serialize`
+ *
+ * [output] dest    Destination to receive serialized data
+ * [in/out] len     Input size of the destination / Output serialized length
+ * [input]  t       Array of tokens to be serialized
+ * [input]  nTok    Number of tokens to be serialized
+ *
+ * Returns the length of the serialized data, or negative error
+ */
+ETLV_API int etlv_serialize_encoded(void* dest, int* len,
+                                    const ETLVEncodedToken* t, int nTok);
+
+/**
+ * Schemas
+ *
+ * Messages with a fixed layout can be described by a static table of fields,
+ * see `ETLV_FIELD`. Decoding checks each expected tag with a direct compare of
+ * its encoded bytes and writes the value straight into the field's member,
+ * instead of searching for every tag. Encoding copies the encoded tags.
+ *
+ *     typedef struct { uint32_t id; ETLVToken name; } Msg;
+ *     static const ETLVField msgFields[] = {
+ *         ETLV_FIELD(Msg, id, 0x02, ETLV_FIELD_UINT, 0, NULL),
+ *         ETLV_FIELD(Msg, name, 0x0C, ETLV_FIELD_TOKEN, ETLV_FIELD_OPTIONAL,
+ *                    NULL),
+ *     };
+ *     static const ETLVSchema msgSchema = ETLV_SCHEMA(msgFields);
+ *
+ * Unsigned integers are encoded in the fewest bytes, with a leading zero byte
+ * where needed to keep them positive as an ASN.1 INTEGER.
+ */
+
+/**
+ * Decode one level of TLV data with a schema
+ *
+ * The objects must follow the order of the fields. A missing optional field
+ * leaves its member untouched, a missing required field is an ETLV_ERR_NOENT
+ * error, and an object that is not in the schema is an ETLV_ERR_INVAL error.
+ *
+ * [input]  sch     Schema of the data
+ * [output] out     Struct receiving the decoded fields
+ * [input]  src     Source pointer to TLV data
+ * [input]  srcLen  Length source data to decode
+ *
+ * Returns the length of the decoded data, or negative error
+ */
+ETLV_API int etlv_schema_decode(const ETLVSchema* sch, void* out,
+                                const void* src, int srcLen);
+
+/**
+ * Encode a struct with a schema
+ *
+ * Optional ETLV_FIELD_TOKEN fields with a NULL value are left out, every other
+ * field is always encoded.
+ *
+ * [output] dest    Destination to receive serialized data
+ * [in/out] len     Input size of the destination / Output serialized length
+ * [input]  sch     Schema of the data
+ * [input]  in      Struct holding the fields
+ *
+ * Returns the length of the serialized data, or negative error
+ */
+ETLV_API int etlv_schema_encode(void* dest, int* len, const ETLVSchema* sch,
+                                const void* in);
+
+/**
+ * Allocating variants
+ *
+ * None of the functions above allocate memory, storage is always provided by
+ * the caller. The functions below count the objects first, then allocate
+ * exactly the storage needed through a caller supplied allocator. Memory is
+ * released with the allocator's `free`, or by resetting an arena.
+ */
+
+/**
+ * Initialize a bump pointer arena on a caller supplied buffer
+ *
+ * Allocations are aligned to 16 bytes. Individual allocations cannot be
+ * freed, the whole arena is released at once with `etlv_arena_reset`.
+ *
+ * [output] a       Arena to be initialized
+ * [input]  buf     Memory to allocate from
+ * [input]  cap     Size of the memory
+ */
+ETLV_API void etlv_arena_init(ETLVArena* a, void* buf, size_t cap);
+
+/**
+ * Release every allocation of an arena
+ *
+ * [in/out] a       Arena to be reset
+ */
+ETLV_API void etlv_arena_reset(ETLVArena* a);
+
+/**
+ * Allocate memory from an arena
+ *
+ * [in/out] a       Arena to allocate from
+ * [input]  size    Number of bytes to allocate
+ *
+ * Returns the allocated memory, or NULL if the arena is exhausted
+ */
+ETLV_API void* etlv_arena_alloc(ETLVArena* a, size_t size);
+
+/**
+ * Get an allocator which allocates from an arena
+ *
+ * [input]  a       Arena to allocate from
+ *
+ * Returns the allocator
+ */
+ETLV_API ETLVAllocator etlv_arena_allocator(ETLVArena* a);
+
+/**
+ * Parse TLV encoded data into an allocated token array, see `etlv_parse`
+ *
+ * [output] t       Allocated array of parsed tokens
+ * [output] nTok    Number of tokens parsed
+ * [input]  src     Source pointer to TLV data
+ * [input]  srcLen  Length source data to parse
+ * [input]  a       Allocator for the token array
+ *
+ * Returns the length of the parsed data, or negative error
+ */
+ETLV_API int etlv_parse_alloc(ETLVToken** t, int* nTok, const void* src,
+                              int srcLen, const ETLVAllocator* a);
+
+/**
+ * Parse nested TLV encoded data into an allocated node array, see
+ * `etlv_parse_tree`
+ *
+ * [output] nodes   Allocated array of parsed nodes
+ * [output] nNodes  Number of nodes parsed
+ * [input]  src     Source pointer to TLV data
+ * [input]  srcLen  Length source data to parse
+ * [input]  a       Allocator for the node array
+ *
+ * Returns the length of the parsed data, or negative error
+ */
+ETLV_API int etlv_parse_tree_alloc(ETLVNode** nodes, int* nNodes,
+                                   const void* src, int srcLen,
+                                   const ETLVAllocator* a);
+
+/**
+ * Build an index with allocated storage, see `etlv_index_build`
+ *
+ * The entries are released by passing `idx->e` to the allocator's `free`.
+ *
+ * [output] idx     Index to be built
+ * [input]  src     Source pointer to TLV data
+ * [input]  srcLen  Length source data to index
+ * [input]  a       Allocator for the index entries
+ *
+ * Returns the number of indexed objects, or negative error
+ */
+ETLV_API int etlv_index_build_alloc(ETLVIndex* idx, const void* src, int srcLen,
+                                    const ETLVAllocator* a);
+
+/**
+ * Statistics and tracing
+ *
+ * When built with ETLV_STATS, the decoders keep counters of their work, one
+ * set per thread, and call an optional trace callback of the thread. Without
+ * ETLV_STATS, none of this is compiled in and the decoders run at full speed.
+ * Work done by the jobs of a thread pool is counted on the pool's threads. In
+ * header-only mode, every file including the implementation has its own
+ * counters.
+ */
+
+// Number of error codes, for counting errors by type
+#define ETLV_ERR_COUNT (ETLV_ERR_NOENT - ETLV_ERR_UNKNOWN + 1)
+
+// Counters of the decoders, see `etlv_stats_get`
+typedef struct {
+    uint64_t    tokens;         // Objects parsed, searched or validated
+    uint64_t    bytes;          // Bytes of TLV data handed to the decoders
+    uint64_t    extTags;        // Headers decoded with a multi byte tag
+    uint64_t    longLens;       // Headers decoded with a long form length
+    uint64_t    errors[ETLV_ERR_COUNT]; // Errors, by `err - ETLV_ERR_UNKNOWN`
+    uint64_t    finds;          // Calls to `etlv_find`
+    uint64_t    findScanned;    // Objects scanned by all calls to `etlv_find`
+    uint64_t    findMaxScan;    // Most objects scanned by one `etlv_find`
+} ETLVStats;
+
+// Events reported to a trace callback
+typedef enum {
+    ETLV_TRACE_TOKEN,   // An object was decoded
+    ETLV_TRACE_ERROR,   // A decoder failed
+} ETLVTraceEvent;
+
+// Trace callback. For ETLV_TRACE_TOKEN the token is the decoded object, and
+// `arg` is the offset of its value in the data being decoded. An object of
+// indefinite length may be reported with a length of 0. Objects skipped in
+// bulk while only counting or searching are not reported. For
+// ETLV_TRACE_ERROR the token is NULL and `arg` is the error.
+typedef void (*ETLVTraceCb)(void* ctx, ETLVTraceEvent ev, const ETLVToken* t,
+                            int arg);
+
+#ifdef ETLV_STATS
+/**
+ * Get the counters of the calling thread
+ *
+ * [output] st      Copy of the counters
+ */
+ETLV_API void etlv_stats_get(ETLVStats* st);
+
+/**
+ * Reset the counters of the calling thread to zero
+ */
+ETLV_API void etlv_stats_reset(void);
+
+/**
+ * Set the trace callback of the calling thread
+ *
+ * [input]  cb      Trace callback, or NULL to stop tracing
+ * [input]  ctx     User context passed to the callback
+ */
+ETLV_API void etlv_trace_set(ETLVTraceCb cb, void* ctx);
+#endif
+
+#ifdef EASYTLV_IMPLEMENTATION
+    #include "easytlv.c"
+#endif
 
 #endif /* __EASYTLV_H__ */
@@ -0,0 +1,757 @@
+/**
+ * EasyTLV benchmark
+ *
+ * Every operation is measured on a set of generated corpora. The corpora are
+ * built from a fixed seed, so every run measures the same data. Corpora of
+ * one value size (16 B to 1 MiB) are only serialized, to measure copying. Each case is
+ * warmed up, then timed in a number of samples. It is reported as throughput
+ * at the median sample, with the 50th, 90th and 99th percentile time per call.
+ *
+ * Usage: etlv_bench [--json] [--cpu N] [--samples N] [--filter TEXT]
+ *
+ *   --json         Print one JSON object per case, for tracking numbers
+ *   --cpu N        Pin the benchmark to CPU N (Linux only)
+ *   --samples N    Number of timed samples per case (default 31)
+ *   --filter TEXT  Only run cases whose corpus or operation contains TEXT
+ */
+#ifdef __linux__
+    #define _GNU_SOURCE // For sched_setaffinity
+#else
+    #define _POSIX_C_SOURCE 199309L
+#endif
+#include "../easytlv.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef __linux__
+    #include <sched.h>
+#endif
+
+// Approximate size of each generated corpus
+#define CORPUS_BYTES (512 * 1024)
+
+// Time spent warming up each case, and in each timed sample
+#define WARMUP_SEC 0.05
+#define SAMPLE_SEC 0.01
+
+#define MAX_SAMPLES 1001
+
+// Number of records the corpus is split into for a batch parse
+#define BATCH_RECORDS 64
+
+
+// A generated corpus, with the input of every operation prepared
+typedef struct {
+    const char*         name;
+    uint8_t*            buf;
+    int                 len;
+    uint8_t*            out;        // Room for serializing the corpus again
+    int                 outLen;
+    ETLVToken*          t;          // Top level tokens
+    int                 nTok;
+    ETLVCompactToken*   c;
+    ETLVEncodedToken*   e;
+    ETLVIndexEntry*     idx;
+    ETLVNode*           nodes;      // Nodes at all levels
+    int                 nNodes;
+    ETLVTokenEx*        tx;
+    ETLVIovec*          iov;
+    uint8_t*            hdr;        // Room for the headers of every token
+    int                 hdrLen;
+    ETLVIndex           index;      // Index over the top level
+    ETLVRecord          rec[BATCH_RECORDS];
+    int                 nRec;
+    uint8_t*            patchBuf;   // Copy of the corpus for patching
+    int                 patchLen;
+    ETLVNode*           patchNodes;
+    int                 patchIdx;   // Leaf node whose value is patched
+    int                 patchFlip;
+    int                 serializeOnly;
+} Corpus;
+
+// What an operation counts as the tokens it processed
+typedef enum {
+    BENCH_TOP,      // Top level tokens
+    BENCH_NODES,    // Nodes at all levels
+    BENCH_ONE,      // One token per call
+} BenchUnit;
+
+// An operation measured on every corpus. Returns a checksum of its result, or
+// negative error. Only operations with `serialize` set are measured on the
+// corpora of one value size.
+typedef struct {
+    const char* name;
+    int         (*fn)(Corpus* c);
+    BenchUnit   unit;
+    int         serialize;
+} BenchOp;
+
+typedef struct {
+    int         json;
+    int         cpu;
+    int         samples;
+    const char* filter;
+} BenchArgs;
+
+// Sink for checksums, so no operation can be optimized away
+static volatile int sink;
+
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void* xmalloc(size_t size)
+{
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        printf(" - out of memory\n\r");
+        exit(1);
+    }
+    return p;
+}
+
+static void check(int err, const char* what)
+{
+    if (err < 0) {
+        printf(" - %s failed: %i\n\r", what, err);
+        exit(1);
+    }
+}
+
+// Small deterministic random number generator (xorshift32)
+static uint32_t rng = 0x2545F491;
+static uint32_t rand_next()
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+// Random value bytes shared by all corpora, as large as the largest value
+static uint8_t valBytes[1024 * 1024];
+
+// Value length of the large corpus
+#define LARGE_VAL (64 * 1024)
+
+// Thread pool running every job on the calling thread, to measure the
+// parallel decoders without threads
+static void serial_run(void* ctx, ETLVJob job, void* arg, int n)
+{
+    (void) ctx;
+    for (int i = 0; i < n; i++)
+        job(arg, i);
+}
+
+static const ETLVPool serialPool = {.run = serial_run, .ctx = NULL, .nJobs = 4};
+
+
+// ---- Corpora ----
+
+// Single byte tags, short form lengths and 2 byte values
+static void gen_short(ETLVWriter* w)
+{
+    while (w->pos < CORPUS_BYTES - 4) {
+        ETLVToken t = {0x04 + (rand_next() & 1), 2, valBytes};
+        etlv_writer_add(w, &t);
+    }
+}
+
+// Sequences nested 13 levels deep, each holding a number and a string
+static void gen_deep_level(ETLVWriter* w, int depth)
+{
+    ETLVToken num = {0x02, 1, valBytes};
+    ETLVToken str = {0x0C, 8, valBytes};
+    etlv_writer_begin_constructed(w, depth % 2 ? 0xA0 : 0x30, 0);
+    etlv_writer_add(w, &num);
+    etlv_writer_add(w, &str);
+    if (depth < 12)
+        gen_deep_level(w, depth + 1);
+    etlv_writer_end(w);
+}
+
+static void gen_deep(ETLVWriter* w)
+{
+    while (w->pos < CORPUS_BYTES - 512)
+        gen_deep_level(w, 0);
+}
+
+// 64 KiB values with long form lengths
+static void gen_large(ETLVWriter* w)
+{
+    while (w->pos < CORPUS_BYTES - LARGE_VAL - 8) {
+        ETLVToken t = {0x04, LARGE_VAL, valBytes};
+        etlv_writer_add(w, &t);
+    }
+}
+
+// Three byte tags with short values
+static void gen_extended(ETLVWriter* w)
+{
+    while (w->pos < CORPUS_BYTES - 16) {
+        ETLVToken t = {0x1F8801 + rand_next() % 8, 4 + rand_next() % 8,
+                       valBytes};
+        etlv_writer_add(w, &t);
+    }
+}
+
+// A realistic mix: mostly small fields, with some empty values, medium values
+// with long form lengths, extended tags and small nested groups
+static void gen_mixed(ETLVWriter* w)
+{
+    while (w->pos < CORPUS_BYTES - 2048) {
+        const uint32_t R = rand_next() % 100;
+        ETLVToken t = {0x02 + rand_next() % 4, rand_next() % 24, valBytes};
+        if (R < 15) {
+            t.len = 0;
+        } else if (R < 30) {
+            t.len = 128 + rand_next() % 1024;
+        } else if (R < 40) {
+            t.tag = 0x9F20 + rand_next() % 16;
+        } else if (R < 55) {
+            const int N = 1 + rand_next() % 6;
+            etlv_writer_begin_constructed(w, 0x30, 0);
+            for (int i = 0; i < N; i++) {
+                t.len = rand_next() % 16;
+                etlv_writer_add(w, &t);
+            }
+            etlv_writer_end(w);
+            continue;
+        }
+        etlv_writer_add(w, &t);
+    }
+}
+
+// Values of one size, at least two of them
+static void gen_values(ETLVWriter* w, uint32_t valLen)
+{
+    do {
+        ETLVToken t = {0x04, valLen, valBytes};
+        etlv_writer_add(w, &t);
+    } while (w->pos < CORPUS_BYTES || w->pos < 2 * (int) valLen);
+}
+
+static void gen_val16(ETLVWriter* w) { gen_values(w, 16); }
+static void gen_val256(ETLVWriter* w) { gen_values(w, 256); }
+static void gen_val4k(ETLVWriter* w) { gen_values(w, 4096); }
+static void gen_val1m(ETLVWriter* w) { gen_values(w, sizeof(valBytes)); }
+
+static const struct {
+    const char* name;
+    void        (*gen)(ETLVWriter* w);
+    int         serializeOnly;
+} corpusGens[] = {
+    {"short",       gen_short,      0},
+    {"deep",        gen_deep,       0},
+    {"large",       gen_large,      0},
+    {"extended",    gen_extended,   0},
+    {"mixed",       gen_mixed,      0},
+    {"val16",       gen_val16,      1},
+    {"val256",      gen_val256,     1},
+    {"val4k",       gen_val4k,      1},
+    {"val1m",       gen_val1m,      1},
+};
+#define N_CORPORA ((int) (sizeof(corpusGens) / sizeof(corpusGens[0])))
+
+// Check if a node of a pre-order node array has children
+static int node_has_children(const ETLVNode* nodes, int nNodes, int i)
+{
+    return i + 1 < nNodes && nodes[i+1].parent == i;
+}
+
+// Generate a corpus, and prepare the input of every operation
+static void corpus_init(Corpus* c, const char* name,
+                        void (*gen)(ETLVWriter* w), int serializeOnly)
+{
+    c->name = name;
+    c->serializeOnly = serializeOnly;
+    const int CAP = CORPUS_BYTES + 2 * sizeof(valBytes) + 64;
+    c->buf = xmalloc(CAP);
+
+    ETLVWriter w;
+    etlv_writer_init(&w, c->buf, CAP);
+    gen(&w);
+    ETLVToken target = {0x10, 2, valBytes}; // Search target, found last
+    etlv_writer_add(&w, &target);
+    c->len = etlv_writer_finish(&w);
+    check(c->len, "corpus generation");
+
+    c->outLen = c->len + 64;
+    c->out = xmalloc(c->outLen);
+
+    // Top level tokens, in every form
+    c->nTok = 0;
+    check(etlv_parse(NULL, &c->nTok, c->buf, c->len), "count");
+    c->t = xmalloc(c->nTok * sizeof(*c->t));
+    c->c = xmalloc(c->nTok * sizeof(*c->c));
+    c->e = xmalloc(c->nTok * sizeof(*c->e));
+    c->idx = xmalloc(c->nTok * sizeof(*c->idx));
+    c->tx = xmalloc(c->nTok * sizeof(*c->tx));
+    c->iov = xmalloc(2 * c->nTok * sizeof(*c->iov));
+    c->hdrLen = 16 * c->nTok;
+    c->hdr = xmalloc(c->hdrLen);
+    check(etlv_parse(c->t, &c->nTok, c->buf, c->len), "parse");
+    check(etlv_parse_compact(c->c, &c->nTok, c->buf, c->len), "compact");
+    for (int i = 0; i < c->nTok; i++) {
+        check(etlv_encode_tag(&c->e[i].tag, c->t[i].tag), "encode tag");
+        c->e[i].len = c->t[i].len;
+        c->e[i].val = c->t[i].val;
+    }
+    check(etlv_index_build(&c->index, c->idx, c->nTok, c->buf, c->len),
+          "index");
+
+    // Records of a batch, split between top level objects
+    c->nRec = c->nTok < BATCH_RECORDS ? c->nTok : BATCH_RECORDS;
+    for (int k = 0; k < c->nRec; k++) {
+        const int FIRST = k * c->nTok / c->nRec;
+        const int LAST = (k + 1) * c->nTok / c->nRec - 1;
+        const int BEGIN = FIRST ? (int) (c->c[FIRST-1].off + c->c[FIRST-1].len)
+                                : 0;
+        c->rec[k].src = c->buf + BEGIN;
+        c->rec[k].srcLen = c->c[LAST].off + c->c[LAST].len - BEGIN;
+    }
+
+    // Nodes at all levels
+    c->nNodes = etlv_validate(NULL, c->buf, c->len, 64, 0);
+    check(c->nNodes, "validate");
+    c->nodes = xmalloc(c->nNodes * sizeof(*c->nodes));
+    check(etlv_parse_tree(c->nodes, &c->nNodes, c->buf, c->len), "tree");
+
+    // A copy of the corpus, with a leaf near the middle to be patched
+    c->patchLen = c->len;
+    c->patchBuf = xmalloc(c->len + 64);
+    memcpy(c->patchBuf, c->buf, c->len);
+    c->patchNodes = xmalloc(c->nNodes * sizeof(*c->patchNodes));
+    int nNodes = c->nNodes;
+    check(etlv_parse_tree(c->patchNodes, &nNodes, c->patchBuf, c->len),
+          "patch tree");
+    c->patchIdx = c->nNodes / 2;
+    while (node_has_children(c->patchNodes, c->nNodes, c->patchIdx))
+        c->patchIdx++;
+    c->patchFlip = 0;
+}
+
+static void corpus_free(Corpus* c)
+{
+    free(c->buf);
+    free(c->out);
+    free(c->t);
+    free(c->c);
+    free(c->e);
+    free(c->idx);
+    free(c->nodes);
+    free(c->tx);
+    free(c->iov);
+    free(c->hdr);
+    free(c->patchBuf);
+    free(c->patchNodes);
+}
+
+
+// ---- Operations ----
+
+static int op_parse(Corpus* c)
+{
+    int nTok = c->nTok;
+    return etlv_parse(c->t, &nTok, c->buf, c->len);
+}
+
+static int op_count(Corpus* c)
+{
+    int nTok = 0;
+    int err = etlv_parse(NULL, &nTok, c->buf, c->len);
+    return err < 0 ? err : nTok;
+}
+
+static int op_compact(Corpus* c)
+{
+    int nTok = c->nTok;
+    return etlv_parse_compact(c->c, &nTok, c->buf, c->len);
+}
+
+static int op_parse_ex(Corpus* c)
+{
+    size_t nTok = c->nTok;
+    return etlv_parse_ex(c->tx, &nTok, c->buf, c->len);
+}
+
+static int op_batch(Corpus* c)
+{
+    return etlv_parse_batch(c->rec, c->nRec, c->t, c->nTok, &serialPool);
+}
+
+static int op_find(Corpus* c)
+{
+    ETLVToken t;
+    int err = etlv_find(&t, 0x10, c->buf, c->len);
+    return err < 0 ? err : (int) t.len;
+}
+
+static int op_find_ex(Corpus* c)
+{
+    ETLVTokenEx t;
+    int64_t err = etlv_find_ex(&t, 0x10, c->buf, c->len);
+    return err < 0 ? (int) err : (int) t.len;
+}
+
+static int op_find_last(Corpus* c)
+{
+    ETLVToken t;
+    int err = etlv_find_last(&t, 0x10, c->buf, c->len);
+    return err < 0 ? err : (int) t.len;
+}
+
+// Search for the target and a tag which is never found, in one scan
+static int op_find_many(Corpus* c)
+{
+    static const uint32_t TAGS[] = {0x11, 0x10};
+    ETLVToken t[2];
+    return etlv_find_many(t, TAGS, 2, c->buf, c->len);
+}
+
+// Walk the top level with a cursor
+static int op_iter(Corpus* c)
+{
+    ETLVIter it;
+    ETLVToken t;
+    int n = 0;
+    etlv_iter_init(&it, c->buf, c->len);
+    while (etlv_iter_next(&it, &t) >= 0)
+        n++;
+    return n;
+}
+
+static int op_index(Corpus* c)
+{
+    ETLVIndex idx;
+    return etlv_index_build(&idx, c->idx, c->nTok, c->buf, c->len);
+}
+
+// Look up the tag of every top level object in the prebuilt index
+static int op_index_find(Corpus* c)
+{
+    ETLVToken t;
+    int sum = 0;
+    for (int i = 0; i < c->nTok; i++) {
+        int err = etlv_index_find(&t, &c->index, c->t[i].tag, 0);
+        if (err < 0)
+            return err;
+        sum += t.len;
+    }
+    return sum & 0x7FFFFFFF;
+}
+
+static int op_validate(Corpus* c)
+{
+    return etlv_validate(NULL, c->buf, c->len, 64, 0);
+}
+
+static int op_tree(Corpus* c)
+{
+    int nNodes = c->nNodes;
+    return etlv_parse_tree(c->nodes, &nNodes, c->buf, c->len);
+}
+
+static int op_tree_parallel(Corpus* c)
+{
+    int nNodes = c->nNodes;
+    return etlv_parse_tree_parallel(c->nodes, &nNodes, c->buf, c->len,
+                                    &serialPool);
+}
+
+// Grow and shrink the value of one leaf by a byte, which moves every byte
+// after it
+static int op_patch(Corpus* c)
+{
+    const uint32_t LEN = c->patchNodes[c->patchIdx].tok.len;
+    const int NEW_LEN = c->patchFlip ? LEN - 1 : LEN + 1;
+    c->patchFlip = !c->patchFlip;
+    return etlv_patch(c->patchBuf, &c->patchLen, c->len + 64, c->patchNodes,
+                      c->nNodes, c->patchIdx, valBytes, NEW_LEN);
+}
+
+static int op_serialize(Corpus* c)
+{
+    int len = c->outLen;
+    return etlv_serialize(c->out, &len, c->t, c->nTok);
+}
+
+static int op_encoded(Corpus* c)
+{
+    int len = c->outLen;
+    return etlv_serialize_encoded(c->out, &len, c->e, c->nTok);
+}
+
+static int op_serialize_iov(Corpus* c)
+{
+    int nIov = 2 * c->nTok;
+    int hdrLen = c->hdrLen;
+    return etlv_serialize_iov(c->iov, &nIov, c->hdr, &hdrLen, c->t, c->nTok);
+}
+
+static int op_writer(Corpus* c)
+{
+    ETLVWriter w;
+    etlv_writer_init(&w, c->out, c->outLen);
+    for (int i = 0; i < c->nTok; i++)
+        etlv_writer_add(&w, &c->t[i]);
+    return etlv_writer_finish(&w);
+}
+
+static int op_serialize_tree(Corpus* c)
+{
+    int len = c->outLen;
+    return etlv_serialize_tree(c->out, &len, c->nodes, c->nNodes, NULL);
+}
+
+static int stream_cb(void* ctx, ETLVStreamEvent ev, const ETLVToken* t)
+{
+    (void) ev;
+    *(int*) ctx += t->len;
+    return 0;
+}
+
+// Feed the corpus to a streaming decoder, in chunks of 4 KiB
+static int op_stream(Corpus* c)
+{
+    int total = 0;
+    ETLVStream st;
+    etlv_stream_init(&st, stream_cb, &total);
+    for (int off = 0; off < c->len; off += 4096) {
+        const int N = c->len - off < 4096 ? c->len - off : 4096;
+        int err = etlv_stream_feed(&st, c->buf + off, N);
+        if (err < 0)
+            return err;
+    }
+    int err = etlv_stream_finish(&st);
+    return err < 0 ? err : total;
+}
+
+static const BenchOp ops[] = {
+    {"parse",           op_parse,           BENCH_TOP,      0},
+    {"parse_count",     op_count,           BENCH_TOP,      0},
+    {"parse_compact",   op_compact,         BENCH_TOP,      0},
+    {"parse_ex",        op_parse_ex,        BENCH_TOP,      0},
+    {"parse_batch",     op_batch,           BENCH_TOP,      0},
+    {"find",            op_find,            BENCH_TOP,      0},
+    {"find_ex",         op_find_ex,         BENCH_TOP,      0},
+    {"find_last",       op_find_last,       BENCH_TOP,      0},
+    {"find_many",       op_find_many,       BENCH_TOP,      0},
+    {"iter",            op_iter,            BENCH_TOP,      0},
+    {"index_build",     op_index,           BENCH_TOP,      0},
+    {"index_find",      op_index_find,      BENCH_TOP,      0},
+    {"validate",        op_validate,        BENCH_NODES,    0},
+    {"parse_tree",      op_tree,            BENCH_NODES,    0},
+    {"parse_tree_par",  op_tree_parallel,   BENCH_NODES,    0},
+    {"patch",           op_patch,           BENCH_ONE,      0},
+    {"serialize",       op_serialize,       BENCH_TOP,      1},
+    {"serialize_enc",   op_encoded,         BENCH_TOP,      1},
+    {"serialize_iov",   op_serialize_iov,   BENCH_TOP,      1},
+    {"writer",          op_writer,          BENCH_TOP,      1},
+    {"serialize_tree",  op_serialize_tree,  BENCH_NODES,    1},
+    {"stream",          op_stream,          BENCH_TOP,      0},
+};
+
+
+// ---- Fixed layout messages ----
+
+// A message of 8 numbers
+typedef struct {
+    uint32_t    f[8];
+} BenchMsg;
+
+#define BENCH_FIELD(i) \
+    ETLV_FIELD(BenchMsg, f[i], 0x80 + i, ETLV_FIELD_UINT, 0, NULL)
+
+static const ETLVField benchFields[] = {
+    BENCH_FIELD(0), BENCH_FIELD(1), BENCH_FIELD(2), BENCH_FIELD(3),
+    BENCH_FIELD(4), BENCH_FIELD(5), BENCH_FIELD(6), BENCH_FIELD(7),
+};
+static const ETLVSchema benchSchema = ETLV_SCHEMA(benchFields);
+
+static BenchMsg benchMsg;
+static uint8_t msgBuf[64];
+static int msgLen;
+
+// Decode the message by finding every field
+static int op_msg_find(Corpus* c)
+{
+    (void) c;
+    BenchMsg msg;
+    ETLVToken t;
+    for (int i = 0; i < 8; i++) {
+        int err = etlv_find(&t, 0x80 + i, msgBuf, msgLen);
+        if (err < 0)
+            return err;
+        const uint8_t* v = t.val;
+        msg.f[i] = v[0] << 24 | v[1] << 16 | v[2] << 8 | v[3];
+    }
+    return msg.f[7];
+}
+
+// Decode the message with its schema
+static int op_msg_decode(Corpus* c)
+{
+    (void) c;
+    BenchMsg msg;
+    int err = etlv_schema_decode(&benchSchema, &msg, msgBuf, msgLen);
+    return err < 0 ? err : (int) msg.f[7];
+}
+
+static int op_msg_encode(Corpus* c)
+{
+    (void) c;
+    uint8_t out[64];
+    int len = sizeof(out);
+    return etlv_schema_encode(out, &len, &benchSchema, &benchMsg);
+}
+
+
+// ---- Harness ----
+
+static int cmp_double(const void* a, const void* b)
+{
+    const double X = *(const double*) a;
+    const double Y = *(const double*) b;
+    return (X > Y) - (X < Y);
+}
+
+// Measure one case, and report it
+static void measure(const BenchArgs* args, const char* corpus, const char* op,
+                    int (*fn)(Corpus* c), Corpus* c, double bytes,
+                    double tokens)
+{
+    if (args->filter && !strstr(corpus, args->filter) &&
+        !strstr(op, args->filter))
+        return;
+
+    // Warm up, and find how many calls make up one sample
+    int reps = 0;
+    double start = now_sec();
+    double elapsed = 0;
+    while (elapsed < WARMUP_SEC) {
+        int err = fn(c);
+        check(err, op);
+        sink += err;
+        reps++;
+        elapsed = now_sec() - start;
+    }
+    reps = reps * SAMPLE_SEC / elapsed;
+    if (reps < 1)
+        reps = 1;
+
+    static double ns[MAX_SAMPLES];
+    for (int s = 0; s < args->samples; s++) {
+        start = now_sec();
+        for (int r = 0; r < reps; r++)
+            sink += fn(c);
+        ns[s] = (now_sec() - start) * 1e9 / reps;
+    }
+    qsort(ns, args->samples, sizeof(ns[0]), cmp_double);
+    const double P50 = ns[args->samples * 50 / 100];
+    const double P90 = ns[args->samples * 90 / 100];
+    const double P99 = ns[args->samples * 99 / 100];
+    const double MB_S = bytes / P50 * 1e3;
+    const double MTOK_S = tokens / P50 * 1e3;
+
+    if (args->json) {
+        printf("{\"corpus\": \"%s\", \"op\": \"%s\", \"bytes\": %.0f, "
+               "\"tokens\": %.0f, \"reps\": %d, \"samples\": %d, "
+               "\"ns_p50\": %.1f, \"ns_p90\": %.1f, \"ns_p99\": %.1f, "
+               "\"mb_s\": %.1f, \"mtok_s\": %.2f}\n",
+               corpus, op, bytes, tokens, reps, args->samples, P50, P90, P99,
+               MB_S, MTOK_S);
+    } else {
+        printf(" - %-8s %-14s %9.1f MB/s %8.2f Mtok/s   "
+               "p50 %10.0f  p90 %10.0f  p99 %10.0f ns\n\r",
+               corpus, op, MB_S, MTOK_S, P50, P90, P99);
+    }
+}
+
+static void usage()
+{
+    printf("usage: etlv_bench [--json] [--cpu N] [--samples N] "
+           "[--filter TEXT]\n");
+    exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    BenchArgs args = {.json = 0, .cpu = -1, .samples = 31, .filter = NULL};
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--json"))
+            args.json = 1;
+        else if (!strcmp(argv[i], "--cpu") && i + 1 < argc)
+            args.cpu = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--samples") && i + 1 < argc)
+            args.samples = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--filter") && i + 1 < argc)
+            args.filter = argv[++i];
+        else
+            usage();
+    }
+    if (args.samples < 1 || args.samples > MAX_SAMPLES)
+        usage();
+
+    // Pin to one CPU, so samples are not spread over different cores
+    if (args.cpu >= 0) {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(args.cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0)
+            printf(" - could not pin to CPU %i\n\r", args.cpu);
+#else
+        printf(" - CPU pinning is not supported here\n\r");
+#endif
+    }
+
+    if (!args.json) {
+        printf("\n\n\r-------------------- EasyTLV Bench --------------------\n");
+#ifdef EASYTLV_IMPLEMENTATION
+        printf(" (header-only build)\n\r");
+#endif
+#ifdef ETLV_NO_FAST_PATH
+        printf(" (no fast path)\n\r");
+#endif
+    }
+
+    for (int i = 0; i < (int) sizeof(valBytes); i++)
+        valBytes[i] = rand_next();
+
+    static Corpus corpora[N_CORPORA];
+    for (int k = 0; k < N_CORPORA; k++)
+        corpus_init(&corpora[k], corpusGens[k].name, corpusGens[k].gen,
+                    corpusGens[k].serializeOnly);
+
+    for (int k = 0; k < N_CORPORA; k++) {
+        Corpus* c = &corpora[k];
+        for (int i = 0; i < (int) (sizeof(ops) / sizeof(ops[0])); i++) {
+            if (c->serializeOnly && !ops[i].serialize)
+                continue;
+            const int TOKENS = ops[i].unit == BENCH_TOP ? c->nTok :
+                               ops[i].unit == BENCH_NODES ? c->nNodes : 1;
+            measure(&args, c->name, ops[i].name, ops[i].fn, c, c->len,
+                    TOKENS);
+        }
+    }
+
+    // Fixed layout messages
+    for (int i = 0; i < 8; i++)
+        benchMsg.f[i] = 0x01000000 + i;
+    msgLen = sizeof(msgBuf);
+    check(etlv_schema_encode(msgBuf, &msgLen, &benchSchema, &benchMsg),
+          "schema encode");
+    measure(&args, "msg8", "find", op_msg_find, NULL, msgLen, 8);
+    measure(&args, "msg8", "schema_decode", op_msg_decode, NULL, msgLen, 8);
+    measure(&args, "msg8", "schema_encode", op_msg_encode, NULL, msgLen, 8);
+
+    for (int k = 0; k < N_CORPORA; k++)
+        corpus_free(&corpora[k]);
+    return 0;
+}
@@ -0,0 +1,989 @@
+/**
+ * EasyTLV differential fuzz harness
+ *
+ * Every input is decoded by the optimized build of the library and by a
+ * reference build, and their tokens, nodes, offsets and error codes must all
+ * match. The reference is this same file compiled with FUZZ_REF, which
+ * includes the library in header-only mode with ETLV_NO_FAST_PATH, so every
+ * header goes through `decode_tag` and `decode_length`.
+ *
+ * The decoders which build on these are checked against the same builds: the
+ * streaming decoder must report the same objects however its input is split
+ * into chunks, and batches and parallel trees must match their one call, one
+ * thread counterparts. Every tree must survive a round trip through
+ * `etlv_serialize_tree` and the writer, which must reproduce DER input
+ * exactly, and a patched tree must parse back into the patched nodes.
+ *
+ * The time the optimized decoders spend on each input is recorded in cycles
+ * (the TSC, where available) and the slowest input per byte is reported. A
+ * scaling check then decodes pathological inputs of growing size, and reports
+ * every decoder whose cost per byte grows with the input, such as quadratic
+ * behavior. A cliff fails the run, like a mismatch does.
+ *
+ * Built with ETLV_LIBFUZZER, only `LLVMFuzzerTestOneInput` is provided, for
+ * libFuzzer. Otherwise a standalone driver runs files given on the command
+ * line (as AFL does), or mutates built in seeds:
+ *
+ * Usage: etlv_fuzz [--runs N] [--seed N] [--no-scale] [FILE...]
+ */
+#ifndef FUZZ_REF
+    #define _POSIX_C_SOURCE 199309L
+#endif
+#include "../easytlv.h"
+#include <stdint.h>
+
+// The decoders under test, from one build of the library
+typedef struct {
+    int     (*parse)(ETLVToken* t, int* nTok, const void* src, int srcLen);
+    int     (*parse_compact)(ETLVCompactToken* t, int* nTok, const void* src,
+                             int srcLen);
+    int     (*parse_tree)(ETLVNode* nodes, int* nNodes, const void* src,
+                          int srcLen);
+    int     (*validate)(int* errOff, const void* src, int srcLen, int maxDepth,
+                        int flags);
+    int     (*find)(ETLVToken* t, uint32_t tag, const void* src, int srcLen);
+    int     (*find_last)(ETLVToken* t, uint32_t tag, const void* src,
+                         int srcLen);
+    int64_t (*parse_ex)(ETLVTokenEx* t, size_t* nTok, const void* src,
+                        size_t srcLen);
+    int64_t (*find_ex)(ETLVTokenEx* t, uint32_t tag, const void* src,
+                       size_t srcLen);
+    void    (*iter_init)(ETLVIter* it, const void* src, int srcLen);
+    int     (*iter_next)(ETLVIter* it, ETLVToken* t);
+    int     (*parse_batch)(ETLVRecord* r, int nRec, ETLVToken* t, int nTok,
+                           const ETLVPool* pool);
+    int     (*parse_tree_parallel)(ETLVNode* nodes, int* nNodes,
+                                   const void* src, int srcLen,
+                                   const ETLVPool* pool);
+    void    (*stream_init)(ETLVStream* st, ETLVStreamCb cb, void* ctx);
+    int     (*stream_feed)(ETLVStream* st, const void* src, int srcLen);
+    int     (*stream_finish)(const ETLVStream* st);
+} FuzzImpl;
+
+#ifdef FUZZ_REF
+    #define FUZZ_IMPL fuzzRef
+#else
+    #define FUZZ_IMPL fuzzOpt
+#endif
+
+const FuzzImpl FUZZ_IMPL = {
+    etlv_parse, etlv_parse_compact, etlv_parse_tree, etlv_validate, etlv_find,
+    etlv_find_last, etlv_parse_ex, etlv_find_ex, etlv_iter_init,
+    etlv_iter_next, etlv_parse_batch, etlv_parse_tree_parallel,
+    etlv_stream_init, etlv_stream_feed, etlv_stream_finish,
+};
+
+#ifndef FUZZ_REF
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+#endif
+
+extern const FuzzImpl fuzzRef;
+
+// Largest input, and the most tokens or nodes it can hold
+#define MAX_INPUT 1024
+#define MAX_TOK (MAX_INPUT / 2 + 1)
+
+static uint64_t cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+static void print_hex(const uint8_t* s, int len)
+{
+    printf("(%i) ", len);
+    while (len-- > 0)
+        printf("%02x", *s++);
+    printf("\n\r");
+}
+
+// Input being checked, for reporting mismatches
+static const uint8_t* curIn;
+static int curLen;
+
+#define CHECK(cond, what) \
+    do { \
+        if (!(cond)) { \
+            printf(" - MISMATCH in %s, line %d, input: ", what, __LINE__); \
+            print_hex(curIn, curLen); \
+            fflush(stdout); \
+            abort(); \
+        } \
+    } while (0)
+
+static int same_tok(const ETLVToken* a, const ETLVToken* b)
+{
+    return a->tag == b->tag && a->len == b->len && a->val == b->val;
+}
+
+// Parse with a token array of `cap` entries. Small arrays exercise counting
+// past the end of the array, which skips short objects quickly.
+static void diff_parse(const uint8_t* in, int len, int cap)
+{
+    static ETLVToken a[MAX_TOK], b[MAX_TOK];
+    int na = cap, nb = cap;
+    int ea = fuzzOpt.parse(cap ? a : NULL, &na, in, len);
+    int eb = fuzzRef.parse(cap ? b : NULL, &nb, in, len);
+    CHECK(ea == eb && na == nb, "etlv_parse");
+    if (ea >= 0 || ea == ETLV_ERR_NOMEM) {
+        for (int i = 0; i < na && i < cap; i++)
+            CHECK(same_tok(&a[i], &b[i]), "etlv_parse tokens");
+    }
+
+    static ETLVCompactToken ca[MAX_TOK], cb[MAX_TOK];
+    na = nb = cap;
+    ea = fuzzOpt.parse_compact(cap ? ca : NULL, &na, in, len);
+    eb = fuzzRef.parse_compact(cap ? cb : NULL, &nb, in, len);
+    CHECK(ea == eb && na == nb, "etlv_parse_compact");
+    if (ea >= 0 || ea == ETLV_ERR_NOMEM) {
+        for (int i = 0; i < na && i < cap; i++)
+            CHECK(ca[i].tag == cb[i].tag && ca[i].len == cb[i].len &&
+                  ca[i].off == cb[i].off, "etlv_parse_compact tokens");
+    }
+}
+
+static int same_node(const ETLVNode* a, const ETLVNode* b)
+{
+    return same_tok(&a->tok, &b->tok) && a->depth == b->depth &&
+           a->parent == b->parent && a->next == b->next &&
+           a->flags == b->flags;
+}
+
+static int has_kids(const ETLVNode* nodes, int nNodes, int i)
+{
+    return i + 1 < nNodes && nodes[i + 1].parent == i;
+}
+
+// Constructed bit of the first octet of a tag
+static int constructed(uint32_t tag)
+{
+    while (tag > 0xFF)
+        tag >>= 8;
+    return tag & 0x20;
+}
+
+// Thread pool running every job on this thread. Jobs run backwards, so any
+// dependence on running in order is caught.
+static void serial_run(void* ctx, ETLVJob job, void* arg, int n)
+{
+    (void) ctx;
+    for (int i = n - 1; i >= 0; i--)
+        job(arg, i);
+}
+
+static void diff_tree(const uint8_t* in, int len)
+{
+    static ETLVNode a[MAX_TOK], b[MAX_TOK];
+    int na = MAX_TOK, nb = MAX_TOK;
+    int ea = fuzzOpt.parse_tree(a, &na, in, len);
+    int eb = fuzzRef.parse_tree(b, &nb, in, len);
+    CHECK(ea == eb && na == nb, "etlv_parse_tree");
+    if (ea < 0)
+        return;
+    for (int i = 0; i < na; i++)
+        CHECK(same_node(&a[i], &b[i]), "etlv_parse_tree nodes");
+}
+
+// A parallel tree must match the sequential one, errors included, with a node
+// array of `cap` entries
+static void diff_tree_parallel(const uint8_t* in, int len, int cap,
+                               const ETLVPool* pool)
+{
+    static ETLVNode a[MAX_TOK], b[MAX_TOK], c[MAX_TOK];
+    int na = cap, nb = cap, nc = cap;
+    int ea = fuzzOpt.parse_tree(a, &na, in, len);
+    int eb = fuzzOpt.parse_tree_parallel(b, &nb, in, len, pool);
+    int ec = fuzzRef.parse_tree_parallel(c, &nc, in, len, pool);
+    CHECK(eb == ec && nb == nc, "etlv_parse_tree_parallel");
+    CHECK(ea == eb && na == nb, "etlv_parse_tree_parallel vs sequential");
+    if (ea < 0)
+        return;
+    for (int i = 0; i < na; i++) {
+        CHECK(same_node(&b[i], &c[i]), "etlv_parse_tree_parallel nodes");
+        CHECK(same_node(&a[i], &b[i]),
+              "etlv_parse_tree_parallel nodes vs sequential");
+    }
+}
+
+static void diff_validate(const uint8_t* in, int len)
+{
+    for (int flags = 0; flags <= ETLV_VALIDATE_MINIMAL; flags++) {
+        int oa = -1, ob = -1;
+        int ea = fuzzOpt.validate(&oa, in, len, 8, flags);
+        int eb = fuzzRef.validate(&ob, in, len, 8, flags);
+        CHECK(ea == eb && oa == ob, "etlv_validate");
+    }
+}
+
+static void diff_find(const uint8_t* in, int len, uint32_t tag)
+{
+    ETLVToken a = {0}, b = {0};
+    int ea = fuzzOpt.find(&a, tag, in, len);
+    int eb = fuzzRef.find(&b, tag, in, len);
+    CHECK(ea == eb, "etlv_find");
+    if (ea >= 0)
+        CHECK(same_tok(&a, &b), "etlv_find token");
+
+    ea = fuzzOpt.find_last(&a, tag, in, len);
+    eb = fuzzRef.find_last(&b, tag, in, len);
+    CHECK(ea == eb, "etlv_find_last");
+    if (ea >= 0)
+        CHECK(same_tok(&a, &b), "etlv_find_last token");
+
+    ETLVTokenEx x = {0}, y = {0};
+    int64_t xa = fuzzOpt.find_ex(&x, tag, in, len);
+    int64_t xb = fuzzRef.find_ex(&y, tag, in, len);
+    CHECK(xa == xb, "etlv_find_ex");
+    if (xa >= 0)
+        CHECK(x.tag == y.tag && x.len == y.len && x.val == y.val,
+              "etlv_find_ex token");
+}
+
+static void diff_ex(const uint8_t* in, int len)
+{
+    static ETLVTokenEx a[MAX_TOK], b[MAX_TOK];
+    size_t na = MAX_TOK, nb = MAX_TOK;
+    int64_t ea = fuzzOpt.parse_ex(a, &na, in, len);
+    int64_t eb = fuzzRef.parse_ex(b, &nb, in, len);
+    CHECK(ea == eb && na == nb, "etlv_parse_ex");
+    if (ea < 0)
+        return;
+    for (size_t i = 0; i < na; i++)
+        CHECK(a[i].tag == b[i].tag && a[i].len == b[i].len &&
+              a[i].val == b[i].val, "etlv_parse_ex tokens");
+}
+
+// A cursor must visit the same objects as etlv_parse, and stop on the same
+// error (an error at the end of the data is only seen by etlv_parse)
+static void cross_iter(const uint8_t* in, int len)
+{
+    static ETLVToken t[MAX_TOK];
+    int nTok = MAX_TOK;
+    int err = fuzzOpt.parse(t, &nTok, in, len);
+
+    ETLVIter it;
+    ETLVToken tok;
+    fuzzOpt.iter_init(&it, in, len);
+    int n = 0;
+    int ei;
+    while ((ei = fuzzOpt.iter_next(&it, &tok)) >= 0) {
+        CHECK(n < MAX_TOK, "etlv_iter_next count");
+        if (err >= 0)
+            CHECK(same_tok(&tok, &t[n]), "etlv_iter_next token");
+        n++;
+    }
+    if (err >= 0)
+        CHECK(ei == ETLV_ERR_NOENT && n == nTok, "etlv_iter_next end");
+}
+
+// Split the input into three records, and parse them as a batch on this
+// thread and in a pool. Every record must parse as it does on its own.
+static void diff_batch(const uint8_t* in, int len, const ETLVPool* pool)
+{
+    // Each record needs at most one more token than a third of the input
+    #define BATCH_TOK (MAX_TOK + 3)
+    static ETLVToken a[BATCH_TOK], b[BATCH_TOK], c[BATCH_TOK];
+    ETLVRecord ra[3], rb[3], rc[3];
+    uint8_t* part[3];
+    const int CUT = len ? in[0] % (len + 1) : 0;
+    const int CUTS[4] = {0, CUT, CUT + (len - CUT) / 2, len};
+    for (int k = 0; k < 3; k++) {
+        // Each record in an allocation of its own, for the sanitizers
+        const int N = CUTS[k + 1] - CUTS[k];
+        part[k] = malloc(N ? N : 1);
+        CHECK(part[k] != NULL, "out of memory");
+        memcpy(part[k], in + CUTS[k], N);
+        ra[k].src = rb[k].src = rc[k].src = part[k];
+        ra[k].srcLen = rb[k].srcLen = rc[k].srcLen = N;
+    }
+
+    int ea = fuzzOpt.parse_batch(ra, 3, a, BATCH_TOK, NULL);
+    int eb = fuzzRef.parse_batch(rb, 3, b, BATCH_TOK, NULL);
+    int ec = fuzzOpt.parse_batch(rc, 3, c, BATCH_TOK, pool);
+    CHECK(ea == eb, "etlv_parse_batch");
+    CHECK(ea == ec, "etlv_parse_batch pool");
+    for (int k = 0; k < 3 && ea >= 0; k++) {
+        CHECK(ra[k].result == rb[k].result && ra[k].first == rb[k].first &&
+              ra[k].nTok == rb[k].nTok, "etlv_parse_batch record");
+        CHECK(ra[k].result == rc[k].result && ra[k].first == rc[k].first &&
+              ra[k].nTok == rc[k].nTok, "etlv_parse_batch pool record");
+
+        static ETLVToken t[MAX_TOK];
+        int nTok = MAX_TOK;
+        int err = fuzzOpt.parse(t, &nTok, part[k], ra[k].srcLen);
+        CHECK(err == ra[k].result, "etlv_parse_batch vs etlv_parse");
+        if (err < 0) {
+            CHECK(ra[k].nTok == 0, "etlv_parse_batch error count");
+            continue;
+        }
+        CHECK(nTok == ra[k].nTok, "etlv_parse_batch count");
+        for (int i = 0; i < nTok; i++) {
+            const int I = ra[k].first + i;
+            CHECK(same_tok(&a[I], &b[I]) && same_tok(&a[I], &c[I]),
+                  "etlv_parse_batch tokens");
+            CHECK(same_tok(&a[I], &t[i]), "etlv_parse_batch tokens vs parse");
+        }
+    }
+    for (int k = 0; k < 3; k++)
+        free(part[k]);
+}
+
+// Objects reported by a streaming decoder, in a form which does not depend on
+// how the input was split into chunks: a header for the start and end of
+// every object, and the value bytes in between
+typedef struct {
+    uint8_t buf[16 * MAX_INPUT];
+    int     len; // Can exceed the buffer, the rest is only counted
+} StreamLog;
+
+static void log_bytes(StreamLog* l, const void* src, uint32_t n)
+{
+    const uint8_t* s = src;
+    for (uint32_t i = 0; i < n; i++, l->len++) {
+        if (l->len < (int) sizeof(l->buf))
+            l->buf[l->len] = s[i];
+    }
+}
+
+static void log_header(StreamLog* l, uint8_t kind, const ETLVToken* t)
+{
+    const uint8_t H[9] = {
+        kind, t->tag >> 24, t->tag >> 16, t->tag >> 8, t->tag,
+        t->len >> 24, t->len >> 16, t->len >> 8, t->len,
+    };
+    log_bytes(l, H, sizeof(H));
+}
+
+static int log_event(void* ctx, ETLVStreamEvent ev, const ETLVToken* t)
+{
+    StreamLog* l = ctx;
+    switch (ev) {
+    case ETLV_STREAM_TOKEN:
+        log_header(l, 'B', t);
+        log_bytes(l, t->val, t->len);
+        log_header(l, 'E', t);
+        break;
+    case ETLV_STREAM_BEGIN:
+        log_header(l, 'B', t);
+        break;
+    case ETLV_STREAM_DATA:
+        log_bytes(l, t->val, t->len);
+        break;
+    default:
+        log_header(l, 'E', t);
+        break;
+    }
+    return 0;
+}
+
+// Feed the input to a streaming decoder in chunks of `chunk` bytes
+// Returns the first error, or the result of `etlv_stream_finish`
+static int run_stream(const FuzzImpl* impl, StreamLog* l, const uint8_t* in,
+                      int len, int chunk)
+{
+    ETLVStream st;
+    l->len = 0;
+    impl->stream_init(&st, log_event, l);
+    for (int off = 0; off < len; off += chunk) {
+        // Each chunk in an allocation of its own, for the sanitizers
+        const int N = len - off < chunk ? len - off : chunk;
+        uint8_t* part = malloc(N);
+        CHECK(part != NULL, "out of memory");
+        memcpy(part, in + off, N);
+        const int ERR = impl->stream_feed(&st, part, N);
+        free(part);
+        if (ERR < 0)
+            return ERR;
+        CHECK(ERR == N, "etlv_stream_feed length");
+    }
+    return impl->stream_finish(&st);
+}
+
+static int same_log(const StreamLog* a, const StreamLog* b)
+{
+    const int N = a->len < (int) sizeof(a->buf) ? a->len : sizeof(a->buf);
+    return a->len == b->len && !memcmp(a->buf, b->buf, N);
+}
+
+static void diff_stream(const uint8_t* in, int len)
+{
+    static StreamLog whole, a, b;
+    const int CHUNK = len ? 1 + in[len - 1] % 7 : 1;
+    int ew = run_stream(&fuzzOpt, &whole, in, len, len ? len : 1);
+    int ea = run_stream(&fuzzOpt, &a, in, len, CHUNK);
+    int eb = run_stream(&fuzzRef, &b, in, len, CHUNK);
+    CHECK(ea == eb && same_log(&a, &b), "etlv_stream_feed");
+    CHECK(ew == ea && same_log(&whole, &a), "etlv_stream_feed chunks");
+}
+
+// Serialize a parsed tree, which must parse back into the same tree. DER input
+// must come back unchanged, and so must its top level objects through
+// `etlv_serialize`. The writer must produce the same bytes.
+static void check_round_trip(const uint8_t* in, int len, const ETLVPool* pool)
+{
+    static ETLVNode nodes[MAX_TOK], copy[MAX_TOK], again[MAX_TOK];
+    static uint8_t out[MAX_INPUT + 16], par[MAX_INPUT + 16];
+    static uint8_t wout[MAX_INPUT + 16];
+    int n = MAX_TOK;
+    if (fuzzOpt.parse_tree(nodes, &n, in, len) < 0)
+        return;
+    const int DER = fuzzOpt.validate(NULL, in, len, MAX_TOK,
+                                     ETLV_VALIDATE_MINIMAL) >= 0;
+
+    // The lengths of nodes with children are written back, so work on copies
+    memcpy(copy, nodes, n * sizeof(*nodes));
+    int outLen = sizeof(out);
+    int err = etlv_serialize_tree(out, &outLen, copy, n, NULL);
+    CHECK(err >= 0 && err == outLen, "etlv_serialize_tree");
+    if (DER)
+        CHECK(outLen == len && !memcmp(out, in, len),
+              "etlv_serialize_tree DER");
+
+    memcpy(again, nodes, n * sizeof(*nodes));
+    int parLen = sizeof(par);
+    err = etlv_serialize_tree(par, &parLen, again, n, pool);
+    CHECK(err == outLen && !memcmp(par, out, outLen),
+          "etlv_serialize_tree pool");
+
+    int m = MAX_TOK;
+    err = fuzzOpt.parse_tree(again, &m, out, outLen);
+    CHECK(err == outLen && m == n, "etlv_serialize_tree parse");
+    for (int i = 0; i < n; i++) {
+        CHECK(again[i].tok.tag == nodes[i].tok.tag &&
+              again[i].depth == nodes[i].depth &&
+              again[i].parent == nodes[i].parent &&
+              again[i].next == nodes[i].next, "etlv_serialize_tree nodes");
+        CHECK(again[i].tok.len == copy[i].tok.len,
+              "etlv_serialize_tree length");
+        if (!has_kids(nodes, n, i) && nodes[i].tok.len)
+            CHECK(!memcmp(again[i].tok.val, nodes[i].tok.val,
+                          nodes[i].tok.len), "etlv_serialize_tree value");
+    }
+
+    // The same tree through the writer, alternating between no size hint and
+    // the final length, so lengths are both moved and written in place
+    ETLVWriter w;
+    int open[ETLV_WRITER_MAX_DEPTH];
+    int nOpen = 0;
+    etlv_writer_init(&w, wout, sizeof(wout));
+    for (int i = 0; i < n; i++) {
+        while (nOpen && open[nOpen - 1] != nodes[i].parent) {
+            etlv_writer_end(&w);
+            nOpen--;
+        }
+        if (!has_kids(nodes, n, i)) {
+            etlv_writer_add(&w, &nodes[i].tok);
+        } else if (nOpen == ETLV_WRITER_MAX_DEPTH) {
+            break; // Too deep for a writer
+        } else {
+            etlv_writer_begin_constructed(&w, nodes[i].tok.tag,
+                                          i & 1 ? copy[i].tok.len : 0);
+            open[nOpen++] = i;
+        }
+    }
+    if (nOpen < ETLV_WRITER_MAX_DEPTH || !n) {
+        while (nOpen-- > 0)
+            etlv_writer_end(&w);
+        err = etlv_writer_finish(&w);
+        CHECK(err == outLen && !memcmp(wout, out, outLen), "etlv_writer");
+    }
+    if (!DER)
+        return;
+
+    static ETLVToken top[MAX_TOK];
+    int nTop = 0;
+    for (int i = 0; i < n; i++) {
+        if (nodes[i].parent < 0)
+            top[nTop++] = nodes[i].tok;
+    }
+    outLen = sizeof(out);
+    err = etlv_serialize(out, &outLen, top, nTop);
+    CHECK(err == len && outLen == len && !memcmp(out, in, len),
+          "etlv_serialize DER");
+    etlv_writer_init(&w, wout, sizeof(wout));
+    for (int i = 0; i < nTop; i++)
+        etlv_writer_add(&w, &top[i]);
+    err = etlv_writer_finish(&w);
+    CHECK(err == len && !memcmp(wout, in, len), "etlv_writer_add DER");
+}
+
+// Patch a primitive node of a parsed tree with a value of another length. The
+// patched data must parse into the updated nodes.
+static void check_patch(const uint8_t* in, int len)
+{
+    static ETLVNode nodes[MAX_TOK], fresh[MAX_TOK];
+    static uint8_t val[48];
+    if (!len)
+        return;
+    const int CAP = len + 64;
+    uint8_t* buf = malloc(CAP);
+    CHECK(buf != NULL, "out of memory");
+    memcpy(buf, in, len);
+    int n = MAX_TOK;
+    int idx = -1;
+    if (fuzzOpt.parse_tree(nodes, &n, buf, len) >= 0) {
+        for (int k = 0; k < n && idx < 0; k++) {
+            const int I = (in[0] + k) % n;
+            if (!has_kids(nodes, n, I) && !constructed(nodes[I].tok.tag))
+                idx = I;
+        }
+    }
+    if (idx < 0) {
+        free(buf);
+        return;
+    }
+
+    const int VAL_LEN = in[len - 1] % sizeof(val);
+    memset(val, in[len - 1], VAL_LEN);
+    int newLen = len;
+    int err = etlv_patch(buf, &newLen, CAP, nodes, n, idx, val, VAL_LEN);
+    if (err >= 0) {
+        CHECK(err == newLen && nodes[idx].tok.len == (uint32_t) VAL_LEN &&
+              !memcmp(nodes[idx].tok.val, val, VAL_LEN), "etlv_patch value");
+        int m = MAX_TOK;
+        err = fuzzOpt.parse_tree(fresh, &m, buf, newLen);
+        CHECK(err == newLen && m == n, "etlv_patch parse");
+        for (int i = 0; i < n; i++)
+            CHECK(same_node(&fresh[i], &nodes[i]), "etlv_patch nodes");
+    }
+    free(buf);
+}
+
+// Check one input. Returns the cycles the optimized decoders took on it.
+static uint64_t check_input(const uint8_t* in, int len)
+{
+    curIn = in;
+    curLen = len;
+
+    diff_parse(in, len, MAX_TOK);
+    diff_parse(in, len, len ? in[0] % 4 : 0);
+    diff_tree(in, len);
+    diff_validate(in, len);
+    diff_ex(in, len);
+    cross_iter(in, len);
+
+    // Split work across a number of jobs taken from the input
+    const ETLVPool POOL = {serial_run, NULL, len ? 1 + in[len - 1] % 8 : 1};
+    diff_tree_parallel(in, len, MAX_TOK, &POOL);
+    diff_tree_parallel(in, len, len ? in[0] % 4 : 0, &POOL);
+    diff_batch(in, len, &POOL);
+    diff_stream(in, len);
+    check_round_trip(in, len, &POOL);
+    check_patch(in, len);
+
+    // Search for the first tag, one which is never found, and a common one
+    uint32_t first = 0;
+    if (len) {
+        ETLVToken t;
+        if (fuzzOpt.find(&t, 0, in, len) >= 0 || len < 2) {
+            first = in[0];
+        } else {
+            int n = 1;
+            fuzzOpt.parse(&t, &n, in, len);
+            first = t.tag;
+        }
+    }
+    diff_find(in, len, first);
+    diff_find(in, len, 0xFFFFFFFF);
+    diff_find(in, len, 0x02);
+
+    // Time the optimized decoders alone, taking the fastest of a few runs to
+    // filter out interrupts
+    static ETLVToken t[MAX_TOK];
+    static ETLVNode nodes[MAX_TOK];
+    ETLVToken found;
+    uint64_t best = UINT64_MAX;
+    for (int r = 0; r < 3; r++) {
+        int n = MAX_TOK;
+        const uint64_t START = cycles();
+        fuzzOpt.parse(t, &n, in, len);
+        n = MAX_TOK;
+        fuzzOpt.parse_tree(nodes, &n, in, len);
+        fuzzOpt.validate(NULL, in, len, 8, 0);
+        fuzzOpt.find(&found, 0xFFFFFFFF, in, len);
+        const uint64_t T = cycles() - START;
+        best = T < best ? T : best;
+    }
+    return best;
+}
+
+#ifdef ETLV_LIBFUZZER
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    if (size <= MAX_INPUT)
+        check_input(data, size);
+    return 0;
+}
+#else
+
+// Small deterministic random number generator (xorshift32)
+static uint32_t rng = 0x2545F491;
+static uint32_t rand_next()
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+// Seeds, covering the corner cases of tags and lengths
+static const uint8_t seed0[] = {0x02, 0x04, 0x00, 0x00, 0x00, 0x2A,
+                                0x02, 0x01, 0x07};
+static const uint8_t seed1[] = {0x1F, 0x88, 0x01, 0x82, 0x00, 0x03,
+                                0x01, 0x02, 0x03};
+static const uint8_t seed2[] = {0x30, 0x0A, 0x02, 0x01, 0x05, 0xA1, 0x05,
+                                0x04, 0x03, 'a', 'b', 'c', 0x02, 0x01, 0x07};
+static const uint8_t seed3[] = {0x30, 0x80, 0x02, 0x01, 0x05, 0xA1, 0x80,
+                                0x04, 0x03, 'a', 'b', 'c', 0x00, 0x00,
+                                0x00, 0x00, 0x02, 0x01, 0x07};
+static const uint8_t seed4[] = {0x04, 0x85, 0x00, 0x00, 0x00, 0x00, 0x01,
+                                0x04, 0xFF, 0x04, 0x84, 0x80, 0x00, 0x00,
+                                0x00};
+static const uint8_t seed5[] = {0x1F, 0xFF, 0xFF, 0xFF, 0xFF, 0x7F, 0x00,
+                                0x1F, 0x80, 0x01, 0x00, 0x5F, 0x81, 0x82,
+                                0x03, 0x00};
+static const uint8_t seed6[] = {0x04, 0x00, 0x05, 0x00, 0x00, 0x00, 0x04,
+                                0x81, 0x01, 0xAA, 0x04, 0x80, 0x00, 0x00};
+static const uint8_t seed7[] = {0x02, 0x01, 0x01, 0xDF, 0x7F, 0x04, 0x00,
+                                0x00, 0x00, 0x03, 0x02, 0x01, 0x02, 0xDF,
+                                0x7F, 0x04, 0x00, 0x00, 0x00, 0x03};
+static const uint8_t seed8[] = {0x1F};
+static const uint8_t seed9[] = {0x1F, 0x81};
+static const uint8_t seed10[] = {0x1F, 0x81, 0x81};
+
+static const struct {
+    const uint8_t*  buf;
+    int             len;
+} seeds[] = {
+    {seed0, sizeof(seed0)}, {seed1, sizeof(seed1)}, {seed2, sizeof(seed2)},
+    {seed3, sizeof(seed3)}, {seed4, sizeof(seed4)}, {seed5, sizeof(seed5)},
+    {seed6, sizeof(seed6)}, {seed7, sizeof(seed7)}, {seed8, sizeof(seed8)},
+    {seed9, sizeof(seed9)}, {seed10, sizeof(seed10)},
+};
+#define N_SEEDS ((int) (sizeof(seeds) / sizeof(seeds[0])))
+
+// Bytes which change the meaning of a header
+static const uint8_t special[] = {
+    0x00, 0x01, 0x02, 0x1F, 0x20, 0x30, 0x7F, 0x80, 0x81, 0x82, 0x84, 0x85,
+    0xA0, 0xDF, 0xFF,
+};
+
+// Mutate a seed into a new input
+// Returns the length of the input
+static int mutate(uint8_t* buf)
+{
+    const int S = rand_next() % N_SEEDS;
+    int len = seeds[S].len;
+    memcpy(buf, seeds[S].buf, len);
+
+    const int N = 1 + rand_next() % 8;
+    for (int i = 0; i < N; i++) {
+        const int POS = len ? rand_next() % len : 0;
+        switch (rand_next() % 6) {
+        case 0: // Flip a bit
+            if (len)
+                buf[POS] ^= 1 << (rand_next() % 8);
+            break;
+        case 1: // Set a special byte
+            if (len)
+                buf[POS] = special[rand_next() % sizeof(special)];
+            break;
+        case 2: // Insert a byte
+            if (len < MAX_INPUT) {
+                memmove(buf + POS + 1, buf + POS, len - POS);
+                buf[POS] = special[rand_next() % sizeof(special)];
+                len++;
+            }
+            break;
+        case 3: // Delete a byte
+            if (len) {
+                memmove(buf + POS, buf + POS + 1, len - POS - 1);
+                len--;
+            }
+            break;
+        case 4: // Append another seed
+            {
+                const int T = rand_next() % N_SEEDS;
+                if (len + seeds[T].len <= MAX_INPUT) {
+                    memcpy(buf + len, seeds[T].buf, seeds[T].len);
+                    len += seeds[T].len;
+                }
+            }
+            break;
+        default: // Truncate
+            len = POS;
+            break;
+        }
+    }
+    return len;
+}
+
+// Read a whole file as one input
+// Returns the length of the input, or -1
+static int read_file(uint8_t* buf, const char* path)
+{
+    FILE* fp = fopen(path, "rb");
+    if (!fp)
+        return -1;
+    int len = fread(buf, 1, MAX_INPUT, fp);
+    fclose(fp);
+    return len;
+}
+
+
+// ---- Scaling check ----
+
+// Largest pathological input
+#define SCALE_MAX (16 * 1024)
+
+// Long form lengths: 04 84 00 00 00 01 xx
+static int gen_long_lens(uint8_t* buf, int size)
+{
+    int len = 0;
+    while (len + 7 <= size) {
+        const uint8_t OBJ[] = {0x04, 0x84, 0x00, 0x00, 0x00, 0x01, 0xAA};
+        memcpy(buf + len, OBJ, sizeof(OBJ));
+        len += sizeof(OBJ);
+    }
+    return len;
+}
+
+// Longest extended tags: 1F 81 82 03 01 xx
+static int gen_ext_tags(uint8_t* buf, int size)
+{
+    int len = 0;
+    while (len + 6 <= size) {
+        const uint8_t OBJ[] = {0x1F, 0x81, 0x82, 0x03, 0x01, 0xAA};
+        memcpy(buf + len, OBJ, sizeof(OBJ));
+        len += sizeof(OBJ);
+    }
+    return len;
+}
+
+// Empty values: 04 00
+static int gen_empty(uint8_t* buf, int size)
+{
+    memset(buf, 0, size & ~1);
+    for (int i = 0; i < size / 2; i++)
+        buf[2 * i] = 0x04;
+    return size & ~1;
+}
+
+// Indefinite lengths nested as deep as the size allows: 30 80 ... 00 00
+static int gen_nested_indef(uint8_t* buf, int size)
+{
+    const int DEPTH = size / 4;
+    for (int i = 0; i < DEPTH; i++) {
+        buf[2 * i] = 0x30;
+        buf[2 * i + 1] = 0x80;
+    }
+    memset(buf + 2 * DEPTH, 0, 2 * DEPTH);
+    return 4 * DEPTH;
+}
+
+// Definite lengths nested as deep as the size allows, built from the inside
+// out: 30 84 LL LL LL LL ...
+static int gen_nested_def(uint8_t* buf, int size)
+{
+    static uint8_t tmp[SCALE_MAX];
+    int pos = size;
+    while (pos >= 6) {
+        const uint32_t LEN = size - pos;
+        pos -= 6;
+        tmp[pos] = 0x30;
+        tmp[pos + 1] = 0x84;
+        tmp[pos + 2] = LEN >> 24;
+        tmp[pos + 3] = LEN >> 16;
+        tmp[pos + 4] = LEN >> 8;
+        tmp[pos + 5] = LEN;
+    }
+    memcpy(buf, tmp + pos, size - pos);
+    return size - pos;
+}
+
+static const struct {
+    const char* name;
+    int         (*gen)(uint8_t* buf, int size);
+} scaleGens[] = {
+    {"long lengths", gen_long_lens},
+    {"extended tags", gen_ext_tags},
+    {"empty values", gen_empty},
+    {"nested indefinite", gen_nested_indef},
+    {"nested definite", gen_nested_def},
+};
+
+static const char* const SCALE_OPS[] = {
+    "parse", "parse_tree", "validate", "find", "iter",
+};
+#define N_SCALE_OPS 5
+
+// Run one decoder over a whole input
+static void scale_op(int op, const uint8_t* in, int len, ETLVNode* nodes,
+                     int nNodes)
+{
+    ETLVToken t;
+    ETLVIter it;
+    int n = 1;
+    switch (op) {
+    case 0: // Count only, so no token array is needed
+        n = 0;
+        fuzzOpt.parse(NULL, &n, in, len);
+        break;
+    case 1:
+        n = nNodes;
+        fuzzOpt.parse_tree(nodes, &n, in, len);
+        break;
+    case 2:
+        fuzzOpt.validate(NULL, in, len, 1 << 20, 0);
+        break;
+    case 3:
+        fuzzOpt.find(&t, 0xFFFFFFFF, in, len);
+        break;
+    default:
+        fuzzOpt.iter_init(&it, in, len);
+        while (fuzzOpt.iter_next(&it, &t) >= 0)
+            ;
+        break;
+    }
+}
+
+// Decode pathological inputs of growing size, and compare the cycles per byte
+// of the smallest and largest. Returns the number of decoders that got more
+// than 4 times slower per byte.
+static int scale_check()
+{
+    static uint8_t buf[SCALE_MAX];
+    static ETLVNode nodes[SCALE_MAX / 2];
+    int cliffs = 0;
+
+    printf("Scaling check (cycles per byte, 1 KiB to 16 KiB)\n\r");
+    for (int g = 0; g < (int) (sizeof(scaleGens) / sizeof(scaleGens[0])); g++) {
+        for (int op = 0; op < N_SCALE_OPS; op++) {
+            double first = 0;
+            double last = 0;
+            printf(" - %-18s %-11s", scaleGens[g].name, SCALE_OPS[op]);
+            for (int size = 1024; size <= SCALE_MAX; size *= 2) {
+                const int LEN = scaleGens[g].gen(buf, size);
+
+                // Take the fastest of a few runs, to filter out noise
+                uint64_t best = UINT64_MAX;
+                for (int r = 0; r < 5; r++) {
+                    const uint64_t START = cycles();
+                    scale_op(op, buf, LEN, nodes, SCALE_MAX / 2);
+                    const uint64_t T = cycles() - START;
+                    best = T < best ? T : best;
+                }
+                last = (double) best / LEN;
+                if (size == 1024)
+                    first = last;
+                printf(" %8.1f", last);
+            }
+            if (last > 4 * first && last > 4) {
+                printf("  <-- CLIFF");
+                cliffs++;
+            }
+            printf("\n\r");
+        }
+    }
+    return cliffs;
+}
+
+int main(int argc, char** argv)
+{
+    long runs = 100000;
+    int scale = 1;
+    int nFiles = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--runs") && i + 1 < argc) {
+            runs = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+            rng = strtoul(argv[++i], NULL, 0);
+            if (!rng)
+                rng = 1;
+        } else if (!strcmp(argv[i], "--no-scale")) {
+            scale = 0;
+        } else if (argv[i][0] == '-') {
+            printf("usage: etlv_fuzz [--runs N] [--seed N] [--no-scale] "
+                   "[FILE...]\n");
+            return 1;
+        } else {
+            argv[nFiles++] = argv[i];
+        }
+    }
+
+    printf("\n\n\r-------------------- EasyTLV Fuzz --------------------\n");
+
+    static uint8_t buf[MAX_INPUT];
+    static uint8_t worst[MAX_INPUT];
+    int worstLen = 0;
+    double worstRate = 0;
+    uint64_t total = 0;
+    uint64_t totalBytes = 0;
+
+    // Files given on the command line are checked once each, otherwise seeds
+    // are mutated
+    const long N = nFiles ? nFiles : runs;
+    for (long r = 0; r < N; r++) {
+        int len;
+        if (nFiles) {
+            len = read_file(buf, argv[r]);
+            if (len < 0) {
+                printf(" - cannot read %s\n\r", argv[r]);
+                return 1;
+            }
+        } else {
+            len = mutate(buf);
+        }
+
+        // Decode from an allocation of the exact size, as libFuzzer does, so
+        // a sanitizer build catches any read past the end of the input
+        uint8_t* in = malloc(len ? len : 1);
+        if (!in) {
+            printf(" - out of memory\n\r");
+            return 1;
+        }
+        memcpy(in, buf, len);
+        const uint64_t T = check_input(in, len);
+        free(in);
+
+        // Small inputs are dominated by call overhead, so they are counted as
+        // 32 bytes long
+        const int SIZE = len > 32 ? len : 32;
+        total += T;
+        totalBytes += SIZE;
+        const double RATE = (double) T / SIZE;
+        if (RATE > worstRate) {
+            worstRate = RATE;
+            worstLen = len;
+            memcpy(worst, buf, len);
+        }
+    }
+
+    printf("Differential test (%ld inputs)\n\r", N);
+    printf(" - cycles per byte: %.1f average, %.1f worst\n\r",
+           totalBytes ? (double) total / totalBytes : 0.0, worstRate);
+    printf(" - worst input: ");
+    print_hex(worst, worstLen);
+    printf(" - TEST PASS\n\r");
+
+    // A cliff fails the run, so it is not lost in the output of a CI job
+    if (scale && !nFiles) {
+        int cliffs = scale_check();
+        printf(" - %d performance cliffs\n\r", cliffs);
+        if (cliffs)
+            return 2;
+    }
+    return 0;
+}
+#endif /* ETLV_LIBFUZZER */
+#endif /* FUZZ_REF */
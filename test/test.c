@@ -1,5 +1,6 @@
 #include "../easytlv.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
@@ -38,6 +39,40 @@ const uint8_t testDataLong[] = {
     0x00, 0x00, 0x01, 0x01,
 };
 
+// Example nested TLV data: a sequence holding a number and a constructed
+// object, followed by another number
+const uint8_t testDataNested[] = {
+    0x30, 0x0A,                 // Constructed sequence: 10 bytes
+    0x02, 0x01, 0x05,           //   Number 5
+    0xA1, 0x05,                 //   Constructed context tag: 5 bytes
+    0x04, 0x03, 'a', 'b', 'c',  //     String "abc"
+    0x02, 0x01, 0x07,           // Number 7
+};
+
+// The same nested TLV data, with indefinite lengths for the constructed
+// objects
+const uint8_t testDataIndef[] = {
+    0x30, 0x80,                 // Constructed sequence: indefinite
+    0x02, 0x01, 0x05,           //   Number 5
+    0xA1, 0x80,                 //   Constructed context tag: indefinite
+    0x04, 0x03, 'a', 'b', 'c',  //     String "abc"
+    0x00, 0x00,                 //   End-of-contents
+    0x00, 0x00,                 // End-of-contents
+    0x02, 0x01, 0x07,           // Number 7
+};
+
+// An append-only log of three records, each ended by a trailer holding the
+// record's length
+const uint8_t testDataLog[] = {
+    0x02, 0x01, 0x01,                           // Number 1
+    0x04, 0x01, 'a',                            // String "a"
+    0xDF, 0x7F, 0x04, 0x00, 0x00, 0x00, 0x06,   // Trailer: 6 bytes
+    0x02, 0x01, 0x02,                           // Number 2
+    0xDF, 0x7F, 0x04, 0x00, 0x00, 0x00, 0x03,   // Trailer: 3 bytes
+    0x04, 0x01, 'b',                            // String "b"
+    0xDF, 0x7F, 0x04, 0x00, 0x00, 0x00, 0x03,   // Trailer: 3 bytes
+};
+
 void print_hex(const void* src, int len)
 {
     if(!src || len < 0)
@@ -49,6 +84,115 @@ void print_hex(const void* src, int len)
         printf("%02x", *s++);
 }
 
+// Collects the values reported by a streaming decoder
+typedef struct {
+    int     nTok;
+    int     nBytes;
+    int     endLen;     // Length of the last object ended
+    uint8_t buf[sizeof(testDataLong)];
+} StreamCheck;
+
+static int stream_cb(void* ctx, ETLVStreamEvent ev, const ETLVToken* t)
+{
+    StreamCheck* c = ctx;
+    switch (ev) {
+    case ETLV_STREAM_TOKEN:
+        c->nTok++;
+        // fall through
+    case ETLV_STREAM_DATA:
+        memcpy(c->buf + c->nBytes, t->val, t->len);
+        c->nBytes += t->len;
+        break;
+    case ETLV_STREAM_END:
+        c->nTok++;
+        c->endLen = t->len;
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
+#ifdef ETLV_STATS
+// Collects the events reported to a trace callback
+typedef struct {
+    int     nTok;
+    int     lastOff;    // Value offset of the last object decoded
+    int     lastErr;
+} TraceCheck;
+
+static void trace_cb(void* ctx, ETLVTraceEvent ev, const ETLVToken* t, int arg)
+{
+    TraceCheck* tc = ctx;
+    if (ev == ETLV_TRACE_TOKEN) {
+        assert(t && t->val);
+        tc->nTok++;
+        tc->lastOff = arg;
+    } else {
+        assert(!t && arg < 0);
+        tc->lastErr = arg;
+    }
+}
+#endif
+
+// Check that patched nodes match a fresh parse of the patched data
+static void check_patched(const ETLVNode* nodes, int nNodes, const void* src,
+                          int srcLen)
+{
+    ETLVNode fresh[8];
+    int n = 8;
+    int err = etlv_parse_tree(fresh, &n, src, srcLen);
+    assert(err == srcLen && n == nNodes);
+    for (int i = 0; i < n; i++) {
+        assert(fresh[i].tok.tag == nodes[i].tok.tag);
+        assert(fresh[i].tok.len == nodes[i].tok.len);
+        assert(fresh[i].tok.val == nodes[i].tok.val);
+        assert(fresh[i].parent == nodes[i].parent);
+    }
+}
+
+// Schema of testDataNested
+typedef struct {
+    ETLVToken   str;
+} TestCtx;
+
+typedef struct {
+    uint32_t    num;
+    TestCtx     ctx;
+} TestSeq;
+
+typedef struct {
+    TestSeq     seq;
+    uint32_t    last;
+    ETLVToken   opt;
+} TestMsg;
+
+static const ETLVField testCtxFields[] = {
+    ETLV_FIELD(TestCtx, str, 0x04, ETLV_FIELD_TOKEN, 0, NULL),
+};
+static const ETLVSchema testCtxSchema = ETLV_SCHEMA(testCtxFields);
+
+static const ETLVField testSeqFields[] = {
+    ETLV_FIELD(TestSeq, num, 0x02, ETLV_FIELD_UINT, 0, NULL),
+    ETLV_FIELD(TestSeq, ctx, 0xA1, ETLV_FIELD_NESTED, 0, &testCtxSchema),
+};
+static const ETLVSchema testSeqSchema = ETLV_SCHEMA(testSeqFields);
+
+static const ETLVField testMsgFields[] = {
+    ETLV_FIELD(TestMsg, seq, 0x30, ETLV_FIELD_NESTED, 0, &testSeqSchema),
+    ETLV_FIELD(TestMsg, last, 0x02, ETLV_FIELD_UINT, 0, NULL),
+    ETLV_FIELD(TestMsg, opt, 0x05, ETLV_FIELD_TOKEN, ETLV_FIELD_OPTIONAL, NULL),
+};
+static const ETLVSchema testMsgSchema = ETLV_SCHEMA(testMsgFields);
+
+// Thread pool which runs every job on the calling thread
+static void serial_run(void* ctx, ETLVJob job, void* arg, int n)
+{
+    (void) ctx;
+    for (int i = 0; i < n; i++)
+        job(arg, i);
+}
+
 static inline int is_big_endian()
 {
     int i=1;
@@ -113,6 +257,7 @@ int main()
     assert(err >= 0);
 
     // Check the parsed tokens
+    assert(nTok == 2);
     assert(t[0].tag == 0x001F8801);
     assert(t[0].len == 257);
     assert(t[0].val == testDataLong + 3 + 3);
@@ -120,6 +265,19 @@ int main()
     assert(numChk == 257);
     printf(" - TEST PASS\n\r");
 
+    printf("Count test (LONG DATA)\n\r");
+    int nCount = 0;
+    err = etlv_parse(NULL, &nCount, testDataLong, sizeof(testDataLong));
+    printf(" - result: %i\n\r", err);
+    assert(err == sizeof(testDataLong));
+    assert(nCount == 2);
+    nCount = 1;
+    err = etlv_parse(t, &nCount, testDataLong, sizeof(testDataLong));
+    printf(" - result (1 token array): %i\n\r", err);
+    assert(err == ETLV_ERR_NOMEM);
+    assert(nCount == 2);
+    printf(" - TEST PASS\n\r");
+
     printf("Serialization test (LONG DATA)\n\r");
     printf(" - re-serializing same data as before\n\r");
 
@@ -131,6 +289,56 @@ int main()
     assert(0 == memcmp(tlvRaw, testDataLong, tlvBufSz));
     printf(" - TEST PASS\n\r");
 
+    printf("Serialization test (LONG DATA -- short buffer)\n\r");
+    tlvBufSz = sizeof(testDataLong) - 1;
+    err = etlv_serialize(tlvRaw, &tlvBufSz, t, nTok);
+    printf(" - result: %i\n\r", err);
+    assert(err == ETLV_ERR_NOMEM);
+    printf(" - TEST PASS\n\r");
+
+    printf("Scatter/gather serialization test (LONG DATA)\n\r");
+    ETLVIovec iov[4];
+    int nIov = sizeof(iov)/sizeof(iov[0]);
+    uint8_t hdr[16];
+    int hdrLen = sizeof(hdr);
+    err = etlv_serialize_iov(iov, &nIov, hdr, &hdrLen, t, nTok);
+    printf(" - result: %i\n\r", err);
+    assert(err == sizeof(testDataLong));
+    assert(nIov == 4 && hdrLen == 3 + 3 + 1 + 1);
+    assert(iov[1].base == t[0].val && iov[3].base == t[1].val);
+    int iovOff = 0;
+    for (int i = 0; i < nIov; i++) {
+        assert(0 == memcmp(testDataLong + iovOff, iov[i].base, iov[i].len));
+        iovOff += iov[i].len;
+    }
+    assert(iovOff == sizeof(testDataLong));
+    printf(" - TEST PASS\n\r");
+
+    printf("Serialized size test (LONG DATA)\n\r");
+    err = etlv_serialized_size(t, nTok);
+    printf(" - result: %i\n\r", err);
+    assert(err == sizeof(testDataLong));
+    const uint8_t zeroVal = 0x55;
+    const ETLVToken zeroTag = {.tag = 0x1F8100, .len = 1, .val = &zeroVal};
+    const uint8_t zeroRaw[] = {0x1F, 0x81, 0x00, 0x01, 0x55};
+    uint8_t zeroBuf[sizeof(zeroRaw) + 1];
+    int zeroSz = sizeof(zeroBuf);
+    err = etlv_serialized_size(&zeroTag, 1);
+    printf(" - result (tag ending in 00): %i\n\r", err);
+    assert(err == sizeof(zeroRaw));
+    assert(etlv_serialize(zeroBuf, &zeroSz, &zeroTag, 1) == err);
+    assert(zeroSz == err && 0 == memcmp(zeroBuf, zeroRaw, sizeof(zeroRaw)));
+    ETLVToken zeroTok;
+    int nZero = 1;
+    assert(etlv_parse(&zeroTok, &nZero, zeroBuf, zeroSz) == zeroSz);
+    assert(zeroTok.tag == zeroTag.tag && zeroTok.len == 1);
+    const uint8_t tag5Raw[] = {0x1F, 0x88, 0xFF, 0x82, 0x00, 0x01, 0x55};
+    nZero = 1;
+    err = etlv_parse(&zeroTok, &nZero, tag5Raw, sizeof(tag5Raw));
+    printf(" - result (5 tag octets): %i\n\r", err);
+    assert(err == ETLV_ERR_OVERFLOW);
+    printf(" - TEST PASS\n\r");
+
     // Search for both tags
     printf("Tag search test (LONG DATA -- first tag)\n\r");
     ETLVToken needle;
@@ -145,5 +353,824 @@ int main()
     assert(err == 263);
     assert(0 == memcmp(&t[1], &needle, sizeof(needle)));
     printf(" - TEST PASS\n\r");
-}
+    printf("Tag search test (LONG DATA -- missing tags)\n\r");
+    err = etlv_find(&needle, 0x1F8802, testDataLong, sizeof(testDataLong));
+    printf(" - result: %i\n\r", err);
+    assert(err == ETLV_ERR_NOENT);
+    err = etlv_find(&needle, 0x00, testDataLong, 0);
+    assert(err == ETLV_ERR_NOENT);
+    printf(" - TEST PASS\n\r");
+
+    // ---- TEST ON NESTED DATA ----
+    printf("Tree parse test (NESTED DATA)\n\r");
+    ETLVNode nodes[5];
+    int nNodes = sizeof(nodes)/sizeof(nodes[0]);
+    err = etlv_parse_tree(nodes, &nNodes, testDataNested, sizeof(testDataNested));
+    printf(" - result: %i\n\r", err);
+    assert(err == sizeof(testDataNested));
+    assert(nNodes == 5);
+    assert(nodes[0].tok.tag == 0x30 && nodes[0].depth == 0);
+    assert(nodes[0].parent == -1 && nodes[0].next == 4);
+    assert(nodes[1].tok.tag == 0x02 && nodes[1].depth == 1);
+    assert(nodes[1].parent == 0 && nodes[1].next == 2);
+    assert(nodes[2].tok.tag == 0xA1 && nodes[2].next == -1);
+    assert(nodes[3].tok.tag == 0x04 && nodes[3].depth == 2);
+    assert(nodes[3].parent == 2 && nodes[3].tok.len == 3);
+    assert(0 == memcmp(nodes[3].tok.val, "abc", 3));
+    assert(nodes[4].tok.tag == 0x02 && nodes[4].depth == 0);
+    assert(nodes[4].parent == -1 && nodes[4].next == -1);
+    nNodes = 4;
+    err = etlv_parse_tree(nodes, &nNodes, testDataNested, sizeof(testDataNested));
+    printf(" - result (4 node array): %i\n\r", err);
+    assert(err == ETLV_ERR_NOMEM);
+    printf(" - TEST PASS\n\r");
+
+    printf("Parallel tree parse test (NESTED DATA)\n\r");
+    const ETLVPool treePool = {.run = serial_run, .ctx = 0, .nJobs = 4};
+    uint8_t nested2[2 * sizeof(testDataNested)];
+    memcpy(nested2, testDataNested, sizeof(testDataNested));
+    memcpy(nested2 + sizeof(testDataNested), testDataNested, sizeof(testDataNested));
+    ETLVNode pNodes[10];
+    ETLVNode sNodes[10];
+    int nPar = 10;
+    int nSeq = 10;
+    err = etlv_parse_tree_parallel(pNodes, &nPar, nested2, sizeof(nested2), &treePool);
+    printf(" - result: %i\n\r", err);
+    assert(err == sizeof(nested2));
+    err = etlv_parse_tree(sNodes, &nSeq, nested2, sizeof(nested2));
+    assert(err == sizeof(nested2));
+    assert(nPar == 10 && nSeq == 10);
+    for (int i = 0; i < nSeq; i++) {
+        assert(0 == memcmp(&pNodes[i].tok, &sNodes[i].tok, sizeof(ETLVToken)));
+        assert(pNodes[i].depth == sNodes[i].depth);
+        assert(pNodes[i].parent == sNodes[i].parent);
+        assert(pNodes[i].next == sNodes[i].next);
+    }
+    nPar = 9;
+    err = etlv_parse_tree_parallel(pNodes, &nPar, nested2, sizeof(nested2), &treePool);
+    assert(err == ETLV_ERR_NOMEM);
+    // A nested error comes before a truncated top level object
+    const uint8_t badTree[] = {0x30, 0x03, 0x02, 0x85, 0x00, 0x04, 0x05, 0x00};
+    nPar = nSeq = 10;
+    err = etlv_parse_tree(sNodes, &nSeq, badTree, sizeof(badTree));
+    assert(err < 0);
+    assert(err == etlv_parse_tree_parallel(pNodes, &nPar, badTree,
+                                           sizeof(badTree), &treePool));
+    printf(" - result (invalid data): %i\n\r", err);
+    nSeq = 10;
+    err = etlv_parse_tree(sNodes, &nSeq, nested2, sizeof(nested2));
+    assert(err == sizeof(nested2));
+    printf(" - TEST PASS\n\r");
+
+    printf("Tree serialization test (NESTED DATA)\n\r");
+    uint8_t treeRaw[sizeof(nested2)];
+    for (int pass = 0; pass < 2; pass++) {
+        // Lengths of constructed nodes are computed
+        sNodes[0].tok.len = sNodes[7].tok.len = 1000;
+        int treeSz = sizeof(treeRaw);
+        err = etlv_serialize_tree(treeRaw, &treeSz, sNodes, nSeq, pass ? &treePool : 0);
+        printf(" - result (%s): %i\n\r", pass ? "thread pool" : "no pool", err);
+        assert(err == sizeof(nested2) && treeSz == sizeof(nested2));
+        assert(0 == memcmp(treeRaw, nested2, sizeof(nested2)));
+    }
+    int treeSz = sizeof(nested2) - 1;
+    err = etlv_serialize_tree(treeRaw, &treeSz, sNodes, nSeq, 0);
+    assert(err == ETLV_ERR_NOMEM);
+    sNodes[4].parent = 1; // Earlier node, but its subtree is already closed
+    treeSz = sizeof(treeRaw);
+    err = etlv_serialize_tree(treeRaw, &treeSz, sNodes, nSeq, 0);
+    printf(" - result (not in pre-order): %i\n\r", err);
+    assert(err == ETLV_ERR_INVAL);
+    sNodes[4].parent = -5; // Not a node at all
+    treeSz = sizeof(treeRaw);
+    err = etlv_serialize_tree(treeRaw, &treeSz, sNodes, nSeq, 0);
+    assert(err == ETLV_ERR_INVAL);
+    sNodes[4].parent = -1;
+    const uint8_t zeroTagVal = 0x55;
+    ETLVNode zeroNode = {.tok = {.tag = 0x1F8100, .len = 1, .val = &zeroTagVal},
+                         .parent = -1};
+    memset(treeRaw, 0xEE, sizeof(treeRaw));
+    treeSz = sizeof(treeRaw);
+    err = etlv_serialize_tree(treeRaw, &treeSz, &zeroNode, 1, 0);
+    printf(" - result (tag ending in 00): %i\n\r", err);
+    assert(err == 5 && treeSz == 5);
+    assert(0 == memcmp(treeRaw, "\x1F\x81\x00\x01\x55", 5));
+    printf(" - TEST PASS\n\r");
+
+    printf("Validation test (NESTED DATA)\n\r");
+    int errOff = -1;
+    err = etlv_validate(&errOff, testDataNested, sizeof(testDataNested), 2,
+                        ETLV_VALIDATE_MINIMAL);
+    printf(" - result: %i\n\r", err);
+    assert(err == 5);
+    err = etlv_validate(&errOff, testDataNested, sizeof(testDataNested), 1, 0);
+    printf(" - result (max depth 1): %i\n\r", err);
+    assert(err == ETLV_ERR_OVERFLOW && errOff == 5);
+    uint8_t bad[sizeof(testDataNested)];
+    memcpy(bad, testDataNested, sizeof(bad));
+    bad[8] = 0x04; // String runs past its parent
+    err = etlv_validate(&errOff, bad, sizeof(bad), 2, 0);
+    printf(" - result (bad length): %i\n\r", err);
+    assert(err == ETLV_ERR_MSGSIZE && errOff == 7);
+    err = etlv_validate(&errOff, testDataLong, sizeof(testDataLong), 0, 0);
+    assert(err == 2);
+    err = etlv_validate(&errOff, testDataLong, sizeof(testDataLong), 0,
+                        ETLV_VALIDATE_MINIMAL);
+    printf(" - result (minimal LONG DATA): %i\n\r", err);
+    assert(err == 2);
+    const uint8_t longLen[] = {0x02, 0x81, 0x01, 0x2A};
+    err = etlv_validate(&errOff, longLen, sizeof(longLen), 0, 0);
+    assert(err == 1);
+    err = etlv_validate(&errOff, longLen, sizeof(longLen), 0,
+                        ETLV_VALIDATE_MINIMAL);
+    printf(" - result (non-minimal length): %i\n\r", err);
+    assert(err == ETLV_ERR_INVAL && errOff == 0);
+    uint8_t* cut = malloc(2); // Exact size, so reading past it is caught
+    assert(cut);
+    cut[0] = 0x1F; // Extended tag, cut off after a continued octet
+    cut[1] = 0x81;
+    err = etlv_validate(&errOff, cut, 2, 0, 0);
+    printf(" - result (truncated tag): %i\n\r", err);
+    assert(err == ETLV_ERR_MSGSIZE && errOff == 0);
+    int nCut = 1;
+    ETLVToken cutTok;
+    err = etlv_parse(&cutTok, &nCut, cut, 2);
+    assert(err == ETLV_ERR_MSGSIZE);
+    free(cut);
+    printf(" - TEST PASS\n\r");
 
+    printf("Index test (NESTED DATA)\n\r");
+    ETLVIndexEntry entries[2];
+    ETLVIndex idx;
+    err = etlv_index_build(&idx, entries, 2, testDataNested, sizeof(testDataNested));
+    printf(" - result: %i\n\r", err);
+    assert(err == 2);
+    err = etlv_index_find(&needle, &idx, 0x02, 0);
+    assert(err == 12);
+    assert(0 == memcmp(&nodes[4].tok, &needle, sizeof(needle)));
+    err = etlv_index_find(&needle, &idx, 0x30, 0);
+    assert(err == 0);
+    assert(0 == memcmp(&nodes[0].tok, &needle, sizeof(needle)));
+    err = etlv_index_find(&needle, &idx, 0x30, 1);
+    assert(err == ETLV_ERR_NOENT);
+    err = etlv_index_find(&needle, &idx, 0x04, 0);
+    assert(err == ETLV_ERR_NOENT);
+    printf(" - TEST PASS\n\r");
+
+    printf("Index test (SHORT DATA -- repeated tag)\n\r");
+    err = etlv_index_build(&idx, entries, 2, testDataShort, sizeof(testDataShort));
+    printf(" - result: %i\n\r", err);
+    assert(err == 2);
+    err = etlv_index_find(&needle, &idx, 0x02, 1);
+    assert(err == 6);
+    numChk = ntohl(*(uint32_t *)needle.val);
+    assert(numChk == 257);
+    printf(" - TEST PASS\n\r");
+
+    printf("Multi-tag search test (NESTED DATA)\n\r");
+    const uint32_t manyTags[] = {0x02, 0x04, 0x30};
+    ETLVToken many[3];
+    err = etlv_find_many(many, manyTags, 3, testDataNested, sizeof(testDataNested));
+    printf(" - result: %i\n\r", err);
+    assert(err == 2);
+    assert(0 == memcmp(&nodes[4].tok, &many[0], sizeof(many[0])));
+    assert(many[1].tag == 0x04 && many[1].val == 0 && many[1].len == 0);
+    assert(0 == memcmp(&nodes[0].tok, &many[2], sizeof(many[2])));
+    printf(" - TEST PASS\n\r");
+
+    // ---- TEST ON STREAMED DATA ----
+    printf("Stream test (LONG DATA -- one byte per chunk)\n\r");
+    StreamCheck chk = {0};
+    ETLVStream st;
+    etlv_stream_init(&st, stream_cb, &chk);
+    for (int i = 0; i < (int) sizeof(testDataLong); i++) {
+        err = etlv_stream_feed(&st, &testDataLong[i], 1);
+        assert(err == 1);
+    }
+    err = etlv_stream_finish(&st);
+    printf(" - result: %i\n\r", err);
+    assert(err == ETLV_ERR_OK);
+    assert(chk.nTok == 2);
+    assert(chk.nBytes == 257 + 4);
+    assert(0 == memcmp(chk.buf, testDataLong + 6, 257));
+    assert(0 == memcmp(chk.buf + 257, testDataLong + 6 + 257 + 2, 4));
+    printf(" - TEST PASS\n\r");
+
+    printf("Stream test (LONG DATA -- truncated)\n\r");
+    memset(&chk, 0, sizeof(chk));
+    etlv_stream_init(&st, stream_cb, &chk);
+    err = etlv_stream_feed(&st, testDataLong, sizeof(testDataLong) - 1);
+    assert(err == sizeof(testDataLong) - 1);
+    assert(chk.nTok == 1);
+    err = etlv_stream_finish(&st);
+    printf(" - result: %i\n\r", err);
+    assert(err == ETLV_ERR_MSGSIZE);
+    printf(" - TEST PASS\n\r");
+
+    printf("Stream test (5 tag octets)\n\r");
+    etlv_stream_init(&st, stream_cb, &chk);
+    err = etlv_stream_feed(&st, tag5Raw, sizeof(tag5Raw));
+    printf(" - result: %i\n\r", err);
+    assert(err == ETLV_ERR_OVERFLOW);
+    printf(" - TEST PASS\n\r");
+
+    // ---- TEST ON WRITTEN DATA ----
+    printf("Writer test (NESTED DATA)\n\r");
+    uint8_t num5 = 5;
+    uint8_t num7 = 7;
+    const ETLVToken wTok[] = {
+        {.tag = 0x02, .len = 1, .val = &num5},
+        {.tag = 0x04, .len = 3, .val = "abc"},
+        {.tag = 0x02, .len = 1, .val = &num7},
+    };
+    ETLVWriter w;
+    etlv_writer_init(&w, tlvRaw, sizeof(tlvRaw));
+    etlv_writer_begin_constructed(&w, 0x30, 0);
+    etlv_writer_add(&w, &wTok[0]);
+    etlv_writer_begin_constructed(&w, 0xA1, 1000); // Too wide, value is moved
+    etlv_writer_add(&w, &wTok[1]);
+    etlv_writer_end(&w);
+    etlv_writer_end(&w);
+    etlv_writer_add(&w, &wTok[2]);
+    err = etlv_writer_finish(&w);
+    printf(" - result: %i\n\r", err);
+    assert(err == sizeof(testDataNested));
+    assert(0 == memcmp(tlvRaw, testDataNested, sizeof(testDataNested)));
+    printf(" - TEST PASS\n\r");
+
+    printf("Writer test (LONG DATA -- length grows)\n\r");
+    etlv_writer_init(&w, tlvRaw, sizeof(tlvRaw));
+    etlv_writer_begin_constructed(&w, 0x30, 0);
+    etlv_writer_add(&w, &t[0]);
+    etlv_writer_end(&w);
+    err = etlv_writer_finish(&w);
+    printf(" - result: %i\n\r", err);
+    assert(err == 4 + 263);
+    assert(tlvRaw[0] == 0x30 && tlvRaw[1] == 0x82);
+    assert(tlvRaw[2] == 0x01 && tlvRaw[3] == 0x07);
+    assert(0 == memcmp(tlvRaw + 4, testDataLong, 263));
+    printf(" - TEST PASS\n\r");
+
+    // ---- TEST ON BATCHED DATA ----
+    const ETLVPool pool = {.run = serial_run, .ctx = 0, .nJobs = 3};
+    for (int pass = 0; pass < 2; pass++) {
+        printf("Batch parse test (%s)\n\r", pass ? "thread pool" : "no pool");
+        ETLVRecord rec[] = {
+            {.src = testDataShort, .srcLen = sizeof(testDataShort)},
+            {.src = testDataLong, .srcLen = sizeof(testDataLong) - 1},
+            {.src = testDataLong, .srcLen = sizeof(testDataLong)},
+            {.src = testDataNested, .srcLen = sizeof(testDataNested)},
+            {.src = testDataShort, .srcLen = sizeof(testDataShort)},
+        };
+        ETLVToken arena[6];
+        err = etlv_parse_batch(rec, 5, arena, 6, pass ? &pool : 0);
+        printf(" - result: %i\n\r", err);
+        assert(err == 6);
+        assert(rec[0].result == sizeof(testDataShort) && rec[0].first == 0);
+        assert(rec[1].result == ETLV_ERR_MSGSIZE);
+        assert(rec[2].result == sizeof(testDataLong) && rec[2].first == 2);
+        assert(rec[3].result == sizeof(testDataNested) && rec[3].first == 4);
+        assert(rec[1].nTok == 0);
+        assert(rec[4].result == ETLV_ERR_NOMEM && rec[4].nTok == 2);
+        assert(0 == memcmp(&arena[3], &t[1], sizeof(t[1])));
+        assert(0 == memcmp(&arena[4], &nodes[0].tok, sizeof(nodes[0].tok)));
+        printf(" - TEST PASS\n\r");
+    }
+
+    // ---- TEST ON 64 BIT LENGTHS ----
+    printf("Parse test (_ex API)\n\r");
+    ETLVTokenEx tEx[2];
+    size_t nTokEx = 2;
+    int64_t errEx = etlv_parse_ex(tEx, &nTokEx, testDataLong, sizeof(testDataLong));
+    printf(" - result: %lli\n\r", (long long) errEx);
+    assert(errEx == sizeof(testDataLong) && nTokEx == 2);
+    assert(tEx[0].tag == t[0].tag && tEx[0].len == t[0].len);
+    assert(tEx[0].val == t[0].val && tEx[1].val == t[1].val);
+    const uint8_t lenOctets5[] = {0x04, 0x85, 0x00, 0x00, 0x00, 0x00, 0x03, 'a', 'b', 'c'};
+    nTokEx = 2;
+    errEx = etlv_parse_ex(tEx, &nTokEx, lenOctets5, sizeof(lenOctets5));
+    printf(" - result (5 length octets): %lli\n\r", (long long) errEx);
+    assert(errEx == sizeof(lenOctets5) && nTokEx == 1 && tEx[0].len == 3);
+    nTok = 2;
+    err = etlv_parse(t, &nTok, lenOctets5, sizeof(lenOctets5));
+    assert(err == ETLV_ERR_OVERFLOW);
+    printf(" - TEST PASS\n\r");
+
+    printf("Serialization test (_ex API)\n\r");
+    nTokEx = 2;
+    etlv_parse_ex(tEx, &nTokEx, testDataLong, sizeof(testDataLong));
+    size_t bufSzEx = sizeof(tlvRaw);
+    errEx = etlv_serialize_ex(tlvRaw, &bufSzEx, tEx, nTokEx);
+    printf(" - result: %lli\n\r", (long long) errEx);
+    assert(errEx == sizeof(testDataLong) && bufSzEx == sizeof(testDataLong));
+    assert(0 == memcmp(tlvRaw, testDataLong, sizeof(testDataLong)));
+    printf(" - TEST PASS\n\r");
+
+    printf("Tag search test (_ex API)\n\r");
+    ETLVTokenEx needleEx;
+    errEx = etlv_find_ex(&needleEx, 0x02, testDataLong, sizeof(testDataLong));
+    printf(" - result: %lli\n\r", (long long) errEx);
+    assert(errEx == 263);
+    assert(needleEx.tag == tEx[1].tag && needleEx.len == tEx[1].len);
+    assert(needleEx.val == tEx[1].val);
+    errEx = etlv_find_ex(&needleEx, 0x04, testDataLong, sizeof(testDataLong));
+    assert(errEx == ETLV_ERR_NOENT);
+    errEx = etlv_find_ex(&needleEx, 0x04, testDataLong, sizeof(testDataLong) - 1);
+    printf(" - result (truncated): %lli\n\r", (long long) errEx);
+    assert(errEx == ETLV_ERR_MSGSIZE);
+    const uint8_t shortCut[] = {0x02, 0x05, 0x00};
+    errEx = etlv_find_ex(&needleEx, 0x04, shortCut, sizeof(shortCut));
+    assert(errEx == ETLV_ERR_MSGSIZE);
+    printf(" - TEST PASS\n\r");
+
+    // ---- TEST ON MAPPED FILES ----
+    printf("File test (NESTED DATA -- caller mapping)\n\r");
+    ETLVFile file;
+    err = etlv_file_map(&file, testDataNested, sizeof(testDataNested));
+    assert(err == ETLV_ERR_OK);
+    ETLVTokenEx seq;
+    errEx = etlv_file_find(&seq, 0x30, &file, 0);
+    assert(errEx == 0 && seq.len == 10);
+    ETLVTokenEx ctx;
+    errEx = etlv_file_find(&ctx, 0xA1, &file, &seq);
+    assert(errEx == 5 && ctx.len == 5);
+    errEx = etlv_file_find(&needleEx, 0x04, &file, &ctx);
+    printf(" - result: %lli\n\r", (long long) errEx);
+    assert(errEx == 7 && needleEx.len == 3);
+    assert(0 == memcmp(needleEx.val, "abc", 3));
+    nTokEx = 2;
+    errEx = etlv_file_parse(tEx, &nTokEx, &file, &seq);
+    assert(errEx == 10 && nTokEx == 2 && tEx[1].val == ctx.val);
+    printf(" - TEST PASS\n\r");
+
+    // ---- TEST ON APPEND-ONLY LOGS ----
+    printf("Log test (LOG DATA)\n\r");
+    uint8_t trailer[ETLV_TRAILER_SIZE];
+    err = etlv_trailer_encode(trailer, sizeof(trailer), 6);
+    assert(err == ETLV_TRAILER_SIZE);
+    assert(0 == memcmp(trailer, testDataLog + 6, ETLV_TRAILER_SIZE));
+    assert(etlv_trailer_encode(trailer, 6, 6) == ETLV_ERR_NOMEM);
+
+    // The newest record holding the tag is found from the tail
+    errEx = etlv_find_last_ex(&needleEx, 0x02, testDataLog, sizeof(testDataLog));
+    printf(" - result: %lli\n\r", (long long) errEx);
+    assert(errEx == 13 && needleEx.len == 1 && needleEx.val == testDataLog + 15);
+    err = etlv_find_last(t, 0x04, testDataLog, sizeof(testDataLog));
+    assert(err == 23 && t[0].len == 1 && *(const uint8_t*) t[0].val == 'b');
+    errEx = etlv_find_last_ex(&needleEx, 0x05, testDataLog, sizeof(testDataLog));
+    assert(errEx == ETLV_ERR_NOENT);
+
+    // Without a trailer, the whole level is searched
+    err = etlv_find_last(t, 0x02, testDataShort, sizeof(testDataShort));
+    assert(err == 6 && t[0].val == testDataShort + 8);
+
+    // Walk the records backwards
+    ETLVLogIter logIt;
+    ETLVTokenEx rec;
+    etlv_log_iter_init(&logIt, testDataLog, sizeof(testDataLog));
+    assert(etlv_log_iter_prev(&logIt, &rec) == 23 && rec.len == 3);
+    assert(etlv_log_iter_prev(&logIt, &rec) == 13 && rec.len == 3);
+    assert(etlv_log_iter_prev(&logIt, &rec) == 0 && rec.len == 6);
+    assert(rec.tag == ETLV_TRAILER_TAG && rec.val == testDataLog);
+    assert(etlv_log_iter_prev(&logIt, &rec) == ETLV_ERR_NOENT);
+
+    // Search one record of a file
+    err = etlv_file_map(&file, testDataLog, sizeof(testDataLog));
+    assert(err == ETLV_ERR_OK);
+    errEx = etlv_file_find_last(&needleEx, 0x04, &file, &rec);
+    assert(errEx == 3 && *(const uint8_t*) needleEx.val == 'a');
+    errEx = etlv_file_find_last(&needleEx, 0x02, &file, 0);
+    assert(errEx == 13);
+
+    // A record cannot exceed the log
+    uint8_t badLog[sizeof(testDataLog)];
+    memcpy(badLog, testDataLog, sizeof(badLog));
+    badLog[sizeof(badLog) - 1] = 0xFF;
+    errEx = etlv_find_last_ex(&needleEx, 0x02, badLog, sizeof(badLog));
+    assert(errEx == ETLV_ERR_INVAL);
+    etlv_log_iter_init(&logIt, testDataLog, sizeof(testDataLog) - 1);
+    assert(etlv_log_iter_prev(&logIt, &rec) == ETLV_ERR_INVAL);
+    printf(" - TEST PASS\n\r");
+
+#ifdef ETLV_USE_MMAP
+    printf("File test (NESTED DATA -- memory mapped)\n\r");
+    const char* path = "etlv_test_file.tlv";
+    FILE* fp = fopen(path, "wb");
+    assert(fp);
+    assert(fwrite(testDataNested, 1, sizeof(testDataNested), fp) == sizeof(testDataNested));
+    fclose(fp);
+    err = etlv_file_open(&file, path);
+    printf(" - result: %i\n\r", err);
+    assert(err == ETLV_ERR_OK);
+    errEx = etlv_file_find(&needleEx, 0x02, &file, 0);
+    assert(errEx == 12 && *(const uint8_t*) needleEx.val == 7);
+    etlv_file_close(&file);
+    remove(path);
+    printf(" - TEST PASS\n\r");
+#endif
+
+    // ---- TEST ON ALLOCATED STORAGE ----
+    printf("Arena allocation test (NESTED DATA)\n\r");
+    static uint8_t arenaBuf[512];
+    ETLVArena arena;
+    etlv_arena_init(&arena, arenaBuf, sizeof(arenaBuf));
+    const ETLVAllocator alloc = etlv_arena_allocator(&arena);
+    ETLVToken* aTok = 0;
+    nTok = 0;
+    err = etlv_parse_alloc(&aTok, &nTok, testDataShort, sizeof(testDataShort), &alloc);
+    printf(" - result (tokens): %i\n\r", err);
+    assert(err == sizeof(testDataShort) && nTok == 2 && aTok);
+    assert(((uintptr_t) aTok) % 16 == 0);
+    assert(aTok[1].val == testDataShort + 8);
+    ETLVNode* aNodes = 0;
+    nNodes = 0;
+    err = etlv_parse_tree_alloc(&aNodes, &nNodes, testDataNested, sizeof(testDataNested), &alloc);
+    printf(" - result (nodes): %i\n\r", err);
+    assert(err == sizeof(testDataNested) && nNodes == 5);
+    assert(aNodes[3].parent == 2 && aNodes[0].next == 4);
+    err = etlv_index_build_alloc(&idx, testDataShort, sizeof(testDataShort), &alloc);
+    printf(" - result (index): %i\n\r", err);
+    assert(err == 2);
+    assert(etlv_index_find(&needle, &idx, 0x02, 1) == 6);
+    err = etlv_parse_tree_alloc(&aNodes, &nNodes, nested2, sizeof(nested2), &alloc);
+    printf(" - result (exhausted): %i\n\r", err);
+    assert(err == ETLV_ERR_NOMEM);
+    etlv_arena_reset(&arena);
+    err = etlv_parse_tree_alloc(&aNodes, &nNodes, nested2, sizeof(nested2), &alloc);
+    assert(err == sizeof(nested2) && nNodes == 10);
+    assert((void*) aNodes == (void*) aTok); // Arena memory was reused
+    const uint8_t misplacedEoc[] = {0x30, 0x80, 0x30, 0x02, 0x00, 0x00};
+    err = etlv_parse_tree_alloc(&aNodes, &nNodes, misplacedEoc,
+                                sizeof(misplacedEoc), &alloc);
+    printf(" - result (misplaced end-of-contents): %i\n\r", err);
+    assert(err == ETLV_ERR_INVAL);
+    printf(" - TEST PASS\n\r");
+
+    // ---- TEST ON COMPACT TOKENS ----
+    printf("Compact token test (LONG DATA)\n\r");
+    assert(sizeof(ETLVCompactToken) == 12);
+    ETLVCompactToken cTok[2];
+    nTok = 2;
+    err = etlv_parse_compact(cTok, &nTok, testDataLong, sizeof(testDataLong));
+    printf(" - result: %i\n\r", err);
+    assert(err == sizeof(testDataLong) && nTok == 2);
+    assert(cTok[0].tag == 0x001F8801 && cTok[0].len == 257 && cTok[0].off == 6);
+    assert(cTok[1].tag == 0x02 && cTok[1].len == 4 && cTok[1].off == 265);
+    ETLVCompactToken cNeedle;
+    err = etlv_find_compact(&cNeedle, 0x02, testDataLong, sizeof(testDataLong));
+    assert(err == 263 && 0 == memcmp(&cNeedle, &cTok[1], sizeof(cNeedle)));
+    tlvBufSz = sizeof(tlvRaw);
+    err = etlv_serialize_compact(tlvRaw, &tlvBufSz, cTok, nTok, testDataLong);
+    assert(err == sizeof(testDataLong));
+    assert(0 == memcmp(tlvRaw, testDataLong, sizeof(testDataLong)));
+    printf(" - TEST PASS\n\r");
+
+    // ---- TEST ON PRE-ENCODED TAGS ----
+    printf("Pre-encoded tag test (LONG DATA)\n\r");
+    ETLVEncodedTag eTag;
+    err = etlv_encode_tag(&eTag, 0x1F);
+    assert(err == ETLV_ERR_INVAL);
+    err = etlv_encode_tag(&eTag, 0x001F8801);
+    assert(err == 3 && eTag.n == 3);
+    assert(eTag.b[0] == 0x1F && eTag.b[1] == 0x88 && eTag.b[2] == 0x01);
+    ETLVEncodedToken eTok[2];
+    eTok[0].tag = eTag;
+    eTok[0].len = 257;
+    eTok[0].val = testDataLong + 6;
+    etlv_encode_tag(&eTok[1].tag, 0x02);
+    eTok[1].len = 4;
+    eTok[1].val = testDataLong + 265;
+    tlvBufSz = sizeof(tlvRaw);
+    err = etlv_serialize_encoded(tlvRaw, &tlvBufSz, eTok, 2);
+    printf(" - result: %i\n\r", err);
+    assert(err == sizeof(testDataLong) && tlvBufSz == err);
+    assert(0 == memcmp(tlvRaw, testDataLong, sizeof(testDataLong)));
+    tlvBufSz = sizeof(testDataLong) - 1;
+    err = etlv_serialize_encoded(tlvRaw, &tlvBufSz, eTok, 2);
+    assert(err == ETLV_ERR_NOMEM);
+    printf(" - TEST PASS\n\r");
+
+    // ---- TEST ON INDEFINITE LENGTHS ----
+    printf("Indefinite length test (PARSE)\n\r");
+    nTok = 2;
+    err = etlv_parse(t, &nTok, testDataIndef, sizeof(testDataIndef));
+    printf(" - result: %i\n\r", err);
+    assert(err == sizeof(testDataIndef) && nTok == 2);
+    assert(t[0].tag == 0x30 && t[0].len == 12);
+    assert(t[0].val == testDataIndef + 2);
+    assert(t[1].tag == 0x02 && t[1].len == 1);
+    assert(t[1].val == testDataIndef + 18);
+    err = etlv_find(&needle, 0x02, testDataIndef, sizeof(testDataIndef));
+    assert(err == 16 && needle.val == testDataIndef + 18);
+    err = etlv_validate(0, testDataIndef, sizeof(testDataIndef), 4, 0);
+    assert(err == 5);
+    err = etlv_validate(0, testDataIndef, sizeof(testDataIndef), 4,
+                        ETLV_VALIDATE_MINIMAL);
+    assert(err == ETLV_ERR_INVAL);
+    const uint8_t indefPrim[] = {0x04, 0x80, 0x01, 0x00, 0x00};
+    nTok = 2;
+    err = etlv_parse(t, &nTok, indefPrim, sizeof(indefPrim));
+    assert(err == ETLV_ERR_INVAL);
+    nTok = 2;
+    err = etlv_parse(t, &nTok, testDataIndef, 14);
+    assert(err == ETLV_ERR_MSGSIZE);
+    printf(" - TEST PASS\n\r");
+
+    printf("Indefinite length test (TREE)\n\r");
+    ETLVNode iNodes[5];
+    int nIndef = 5;
+    err = etlv_parse_tree(iNodes, &nIndef, testDataIndef, sizeof(testDataIndef));
+    printf(" - result: %i\n\r", err);
+    assert(err == sizeof(testDataIndef) && nIndef == 5);
+    assert(iNodes[0].flags == ETLV_NODE_INDEFINITE && iNodes[0].tok.len == 12);
+    assert(iNodes[1].flags == 0 && iNodes[1].parent == 0 && iNodes[1].next == 2);
+    assert(iNodes[2].flags == ETLV_NODE_INDEFINITE && iNodes[2].tok.len == 5);
+    assert(iNodes[3].parent == 2 && iNodes[3].tok.len == 3);
+    assert(iNodes[4].depth == 0 && iNodes[0].next == 4);
+    ETLVNode ipNodes[5];
+    int nIndefPar = 5;
+    err = etlv_parse_tree_parallel(ipNodes, &nIndefPar, testDataIndef,
+                                   sizeof(testDataIndef), &treePool);
+    assert(err == sizeof(testDataIndef) && nIndefPar == 5);
+    for (int i = 0; i < nIndef; i++) {
+        assert(ipNodes[i].tok.len == iNodes[i].tok.len);
+        assert(ipNodes[i].flags == iNodes[i].flags);
+        assert(ipNodes[i].next == iNodes[i].next);
+    }
+    nIndef = 5;
+    err = etlv_parse_tree(iNodes, &nIndef, testDataIndef, 14);
+    assert(err == ETLV_ERR_MSGSIZE);
+
+    // Serializing converts to definite lengths
+    nIndef = 5;
+    etlv_parse_tree(iNodes, &nIndef, testDataIndef, sizeof(testDataIndef));
+    treeSz = sizeof(treeRaw);
+    err = etlv_serialize_tree(treeRaw, &treeSz, iNodes, nIndef, 0);
+    assert(err == sizeof(testDataNested));
+    assert(0 == memcmp(treeRaw, testDataNested, sizeof(testDataNested)));
+    printf(" - TEST PASS\n\r");
+
+    printf("Indefinite length test (STREAM)\n\r");
+    memset(&chk, 0, sizeof(chk));
+    etlv_stream_init(&st, stream_cb, &chk);
+    for (int i = 0; i < (int) sizeof(testDataIndef); i++) {
+        err = etlv_stream_feed(&st, &testDataIndef[i], 1);
+        assert(err == 1);
+    }
+    err = etlv_stream_finish(&st);
+    printf(" - result: %i\n\r", err);
+    assert(err == ETLV_ERR_OK);
+    assert(chk.nTok == 5 && chk.nBytes == 5);
+    assert(0 == memcmp(chk.buf, "\x05" "abc" "\x07", 5));
+    memset(&chk, 0, sizeof(chk));
+    etlv_stream_init(&st, stream_cb, &chk);
+    err = etlv_stream_feed(&st, testDataIndef, 16);
+    assert(err == 16 && chk.endLen == 12);
+    assert(etlv_stream_finish(&st) == ETLV_ERR_OK);
+    etlv_stream_init(&st, stream_cb, &chk);
+    etlv_stream_feed(&st, testDataIndef, 14);
+    assert(etlv_stream_finish(&st) == ETLV_ERR_MSGSIZE);
+    printf(" - TEST PASS\n\r");
+
+    // ---- TEST ON EMPTY VALUES ----
+    printf("Empty value test\n\r");
+    const uint8_t emptyRaw[] = {0x05, 0x00, 0x04, 0x00, 0x30, 0x00};
+    const ETLVToken empty[3] = {{0x05, 0, 0}, {0x04, 0, 0}, {0x30, 0, 0}};
+    assert(etlv_serialized_size(empty, 3) == sizeof(emptyRaw));
+    tlvBufSz = sizeof(tlvRaw);
+    err = etlv_serialize(tlvRaw, &tlvBufSz, empty, 3);
+    printf(" - result: %i\n\r", err);
+    assert(err == sizeof(emptyRaw) && tlvBufSz == err);
+    assert(0 == memcmp(tlvRaw, emptyRaw, sizeof(emptyRaw)));
+    tlvBufSz = sizeof(emptyRaw) - 1;
+    err = etlv_serialize(tlvRaw, &tlvBufSz, empty, 3);
+    assert(err == ETLV_ERR_NOMEM);
+    ETLVWriter ew;
+    etlv_writer_init(&ew, tlvRaw, sizeof(tlvRaw));
+    etlv_writer_add(&ew, &empty[0]);
+    etlv_writer_add(&ew, &empty[1]);
+    etlv_writer_begin_constructed(&ew, 0x30, 0);
+    etlv_writer_end(&ew);
+    err = etlv_writer_finish(&ew);
+    assert(err == sizeof(emptyRaw));
+    assert(0 == memcmp(tlvRaw, emptyRaw, sizeof(emptyRaw)));
+    ETLVEncodedToken eEmpty = {.len = 0, .val = 0};
+    etlv_encode_tag(&eEmpty.tag, 0x05);
+    tlvBufSz = sizeof(tlvRaw);
+    err = etlv_serialize_encoded(tlvRaw, &tlvBufSz, &eEmpty, 1);
+    assert(err == 2 && tlvRaw[0] == 0x05 && tlvRaw[1] == 0x00);
+    ETLVTokenEx exEmpty = {.tag = 0x05, .len = 0, .val = 0};
+    size_t exSz = sizeof(tlvRaw);
+    assert(etlv_serialize_ex(tlvRaw, &exSz, &exEmpty, 1) == 2 && exSz == 2);
+    nTok = 3;
+    err = etlv_parse(many, &nTok, emptyRaw, sizeof(emptyRaw));
+    assert(err == sizeof(emptyRaw) && nTok == 3 && many[2].len == 0);
+    printf(" - TEST PASS\n\r");
+
+    // ---- TEST ON PATCHING ----
+    printf("Patch test (NESTED DATA)\n\r");
+    const uint8_t patchedRaw[] = {
+        0x30, 0x0C, 0x02, 0x01, 0x05, 0xA1, 0x07,
+        0x04, 0x05, 'h', 'e', 'l', 'l', 'o', 0x02, 0x01, 0x07,
+    };
+    uint8_t patchBuf[300];
+    int patchLen = sizeof(testDataNested);
+    memcpy(patchBuf, testDataNested, patchLen);
+    ETLVNode pt[5];
+    int nPt = 5;
+    etlv_parse_tree(pt, &nPt, patchBuf, patchLen);
+    err = etlv_patch(patchBuf, &patchLen, sizeof(patchBuf), pt, nPt, 3,
+                     "hello", 5);
+    printf(" - result: %i\n\r", err);
+    assert(err == sizeof(patchedRaw) && patchLen == err);
+    assert(0 == memcmp(patchBuf, patchedRaw, sizeof(patchedRaw)));
+    check_patched(pt, nPt, patchBuf, patchLen);
+
+    // Same size only copies the value
+    err = etlv_patch(patchBuf, &patchLen, sizeof(patchBuf), pt, nPt, 3,
+                     "HELLO", 5);
+    assert(err == sizeof(patchedRaw) && patchBuf[9] == 'H');
+
+    // Grow into long form lengths, then shrink back
+    uint8_t bigVal[200];
+    memset(bigVal, 0x5A, sizeof(bigVal));
+    err = etlv_patch(patchBuf, &patchLen, sizeof(patchBuf), pt, nPt, 3,
+                     bigVal, sizeof(bigVal));
+    assert(err == 15 + 200 && patchLen == err);
+    check_patched(pt, nPt, patchBuf, patchLen);
+    err = etlv_validate(0, patchBuf, patchLen, 4, ETLV_VALIDATE_MINIMAL);
+    assert(err == 5);
+    err = etlv_patch(patchBuf, &patchLen, sizeof(patchBuf), pt, nPt, 3,
+                     "abc", 3);
+    assert(err == sizeof(testDataNested));
+    assert(0 == memcmp(patchBuf, testDataNested, sizeof(testDataNested)));
+    check_patched(pt, nPt, patchBuf, patchLen);
+
+    // Without room, and on a node with children, nothing changes
+    err = etlv_patch(patchBuf, &patchLen, patchLen + 1, pt, nPt, 3,
+                     "hello", 5);
+    assert(err == ETLV_ERR_NOMEM);
+    err = etlv_patch(patchBuf, &patchLen, sizeof(patchBuf), pt, nPt, 2,
+                     "hello", 5);
+    assert(err == ETLV_ERR_INVAL);
+    assert(0 == memcmp(patchBuf, testDataNested, sizeof(testDataNested)));
+
+    // Indefinite lengths need no length fields rewritten
+    patchLen = sizeof(testDataIndef);
+    memcpy(patchBuf, testDataIndef, patchLen);
+    nPt = 5;
+    etlv_parse_tree(pt, &nPt, patchBuf, patchLen);
+    err = etlv_patch(patchBuf, &patchLen, sizeof(patchBuf), pt, nPt, 3, "", 0);
+    assert(err == sizeof(testDataIndef) - 3);
+    check_patched(pt, nPt, patchBuf, patchLen);
+    assert(pt[0].tok.len == 9 && pt[2].tok.len == 2);
+
+    // An empty object of tag 0 would end its indefinite parent
+    const uint8_t eocRaw[] = {0x30, 0x80, 0x00, 0x01, 0x05, 0x00, 0x00};
+    patchLen = sizeof(eocRaw);
+    memcpy(patchBuf, eocRaw, patchLen);
+    nPt = 5;
+    etlv_parse_tree(pt, &nPt, patchBuf, patchLen);
+    err = etlv_patch(patchBuf, &patchLen, sizeof(patchBuf), pt, nPt, 1, "", 0);
+    assert(err == ETLV_ERR_INVAL);
+    assert(0 == memcmp(patchBuf, eocRaw, sizeof(eocRaw)));
+    printf(" - TEST PASS\n\r");
+
+    // ---- TEST ON CURSORS ----
+    printf("Iterator test (NESTED DATA)\n\r");
+    ETLVIter it, child, grand;
+    ETLVToken cur;
+    etlv_iter_init(&it, testDataNested, sizeof(testDataNested));
+    err = etlv_iter_next(&it, &cur);
+    printf(" - result: %i\n\r", err);
+    assert(err == 0 && cur.tag == 0x30 && cur.len == 10);
+    assert(etlv_iter_enter(&it, &child) == ETLV_ERR_OK);
+    assert(etlv_iter_next(&child, &cur) == 2 && cur.tag == 0x02);
+    assert(etlv_iter_enter(&child, &grand) == ETLV_ERR_INVAL);
+    assert(etlv_iter_next(&child, &cur) == 5 && cur.tag == 0xA1);
+    assert(etlv_iter_enter(&child, &grand) == ETLV_ERR_OK);
+    assert(etlv_iter_next(&grand, &cur) == 7 && cur.len == 3);
+    assert(0 == memcmp(cur.val, "abc", 3));
+    assert(etlv_iter_next(&grand, &cur) == ETLV_ERR_NOENT);
+    assert(etlv_iter_next(&child, &cur) == ETLV_ERR_NOENT);
+    assert(etlv_iter_next(&it, &cur) == 12 && cur.tag == 0x02);
+    assert(etlv_iter_next(&it, &cur) == ETLV_ERR_NOENT);
+
+    // Descend in place, and skip objects
+    etlv_iter_init(&it, testDataNested, sizeof(testDataNested));
+    assert(etlv_iter_next(&it, &cur) == 0);
+    assert(etlv_iter_enter(&it, &it) == ETLV_ERR_OK);
+    assert(etlv_iter_skip(&it, 1) == 1);
+    assert(etlv_iter_next(&it, &cur) == 5 && cur.tag == 0xA1);
+    assert(etlv_iter_skip(&it, 3) == 0);
+
+    // Indefinite lengths are resolved
+    etlv_iter_init(&it, testDataIndef, sizeof(testDataIndef));
+    assert(etlv_iter_next(&it, &cur) == 0 && cur.tag == 0x30 && cur.len == 12);
+    assert(etlv_iter_enter(&it, &child) == ETLV_ERR_OK);
+    assert(etlv_iter_skip(&child, 5) == 2);
+    assert(etlv_iter_next(&it, &cur) == 16 && cur.tag == 0x02);
+
+    // Errors are sticky
+    etlv_iter_init(&it, testDataShort, sizeof(testDataShort) - 1);
+    assert(etlv_iter_skip(&it, 5) == ETLV_ERR_MSGSIZE);
+    assert(etlv_iter_next(&it, &cur) == ETLV_ERR_MSGSIZE);
+    etlv_iter_init(&it, NULL, 4);
+    assert(etlv_iter_next(&it, &cur) == ETLV_ERR_BADARG);
+    printf(" - TEST PASS\n\r");
+
+    // ---- TEST ON SCHEMAS ----
+    printf("Schema test (NESTED DATA)\n\r");
+    assert(ETLV_TAG_LEN(0x1F8801) == 3 && ETLV_TAG_BYTE(0x1F8801, 1) == 0x88);
+    assert(ETLV_TAG_BYTE(0x1F8801, 3) == 0 && ETLV_TAG_BYTE(0x30, 0) == 0x30);
+    TestMsg msg = {0};
+    err = etlv_schema_decode(&testMsgSchema, &msg, testDataNested,
+                             sizeof(testDataNested));
+    printf(" - result: %i\n\r", err);
+    assert(err == sizeof(testDataNested));
+    assert(msg.seq.num == 5 && msg.last == 7 && msg.opt.val == 0);
+    assert(msg.seq.ctx.str.tag == 0x04 && msg.seq.ctx.str.len == 3);
+    assert(msg.seq.ctx.str.val == testDataNested + 9);
+    tlvBufSz = sizeof(tlvRaw);
+    err = etlv_schema_encode(tlvRaw, &tlvBufSz, &testMsgSchema, &msg);
+    assert(err == sizeof(testDataNested) && tlvBufSz == err);
+    assert(0 == memcmp(tlvRaw, testDataNested, sizeof(testDataNested)));
+
+    // Optional fields and integers needing a leading zero
+    msg.opt.len = 0;
+    msg.opt.val = "";
+    msg.last = 0x80;
+    tlvBufSz = sizeof(tlvRaw);
+    err = etlv_schema_encode(tlvRaw, &tlvBufSz, &testMsgSchema, &msg);
+    assert(err == sizeof(testDataNested) + 3);
+    assert(tlvRaw[12] == 0x02 && tlvRaw[13] == 2 && tlvRaw[14] == 0);
+    assert(tlvRaw[15] == 0x80 && tlvRaw[16] == 0x05 && tlvRaw[17] == 0);
+    TestMsg msg2 = {0};
+    assert(etlv_schema_decode(&testMsgSchema, &msg2, tlvRaw, err) == err);
+    assert(msg2.last == 0x80 && msg2.opt.val == tlvRaw + 18);
+    tlvBufSz = err - 1;
+    err = etlv_schema_encode(tlvRaw, &tlvBufSz, &testMsgSchema, &msg);
+    assert(err == ETLV_ERR_NOMEM);
+
+    // Missing, unexpected and left over objects
+    err = etlv_schema_decode(&testMsgSchema, &msg2, testDataNested, 12);
+    assert(err == ETLV_ERR_NOENT);
+    err = etlv_schema_decode(&testSeqSchema, &msg2.seq, testDataNested,
+                             sizeof(testDataNested));
+    assert(err == ETLV_ERR_INVAL);
+    err = etlv_schema_decode(&testMsgSchema, &msg2, testDataLong,
+                             sizeof(testDataLong));
+    assert(err == ETLV_ERR_INVAL);
+    printf(" - TEST PASS\n\r");
+
+#ifdef ETLV_STATS
+    // ---- TEST ON STATISTICS ----
+    printf("Statistics test (LONG DATA)\n\r");
+    ETLVStats stats;
+    etlv_stats_reset();
+    nTok = 2;
+    err = etlv_parse(t, &nTok, testDataLong, sizeof(testDataLong));
+    assert(err == sizeof(testDataLong));
+    err = etlv_find(t, 0x02, testDataLong, sizeof(testDataLong));
+    assert(err == sizeof(testDataLong) - 6);
+    etlv_stats_get(&stats);
+    printf(" - tokens: %u, bytes: %u\n\r", (unsigned) stats.tokens,
+           (unsigned) stats.bytes);
+    assert(stats.tokens == 4 && stats.extTags == 2 && stats.longLens == 2);
+    assert(stats.bytes == 2 * sizeof(testDataLong) - 4);
+    assert(stats.finds == 1 && stats.findScanned == 2 && stats.findMaxScan == 2);
+
+    // Errors are counted by type
+    err = etlv_find(t, 0x05, testDataShort, sizeof(testDataShort));
+    assert(err == ETLV_ERR_NOENT);
+    nTok = 2;
+    err = etlv_parse(t, &nTok, testDataLong, sizeof(testDataLong) - 1);
+    assert(err == ETLV_ERR_MSGSIZE);
+    etlv_stats_get(&stats);
+    assert(stats.finds == 2 && stats.findScanned == 4 && stats.findMaxScan == 2);
+    assert(stats.errors[ETLV_ERR_NOENT - ETLV_ERR_UNKNOWN] == 1);
+    assert(stats.errors[ETLV_ERR_MSGSIZE - ETLV_ERR_UNKNOWN] == 1);
+    assert(stats.errors[ETLV_ERR_INVAL - ETLV_ERR_UNKNOWN] == 0);
+    etlv_stats_reset();
+    etlv_stats_get(&stats);
+    assert(stats.tokens == 0 && stats.errors[ETLV_ERR_NOENT - ETLV_ERR_UNKNOWN] == 0);
+    printf(" - TEST PASS\n\r");
+
+    printf("Trace test (NESTED DATA)\n\r");
+    TraceCheck tc = {0};
+    etlv_trace_set(trace_cb, &tc);
+    ETLVNode tn[5];
+    int nTn = 5;
+    err = etlv_parse_tree(tn, &nTn, testDataNested, sizeof(testDataNested));
+    assert(err == sizeof(testDataNested));
+    assert(tc.nTok == 5 && tc.lastOff == 14 && tc.lastErr == 0);
+    nTn = 5;
+    err = etlv_parse_tree(tn, &nTn, testDataNested, sizeof(testDataNested) - 1);
+    assert(err == ETLV_ERR_MSGSIZE && tc.lastErr == ETLV_ERR_MSGSIZE);
+    etlv_trace_set(NULL, NULL);
+    nTn = 5;
+    etlv_parse_tree(tn, &nTn, testDataNested, sizeof(testDataNested));
+    assert(tc.nTok == 10);
+    printf(" - TEST PASS\n\r");
+#endif
+}